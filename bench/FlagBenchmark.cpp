@@ -0,0 +1,529 @@
+#include <Base/Flag.cpp>
+#include <Base/FixedFlag.h>
+#include <Base/FlagWorld.h>
+#include <Base/SimulationThread.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Benchmarks of the CPU side of the Flag simulation (no OpenGL context is created)
+// ---------------------------------------------------------------------------------
+// usage : FlagBenchmark [grid sizes...]   (default 100 500 2000)
+
+/* runs f() reps times and returns the average duration of one call in milliseconds */
+template<typename F>
+double timeMs(int reps, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+        f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / reps;
+}
+
+// The particle layout used before the structure of arrays store: every pass streams the whole 56 bytes
+struct LegacyParticle
+{
+    bool movable;
+    float mass;
+    Vec3 old_pos;
+    Vec3 acceleration;
+    Vec3 accumulated_normal;
+    Vec3 pos;
+};
+
+/* L1 data and last level cache read misses of the calling thread, read from the perf counters of Linux.
+Without perf counters (other systems, containers, perf_event_paranoid) available() is false and the misses are printed as n/a */
+class CacheCounters
+{
+public:
+    CacheCounters()
+    {
+#ifdef __linux__
+        const uint64_t caches[2] = {PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL};
+        for (int k = 0; k < 2; k++)
+        {
+            perf_event_attr attr = {};
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.size = sizeof(attr);
+            attr.config = caches[k] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[k] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~CacheCounters()
+    {
+#ifdef __linux__
+        for (int k = 0; k < 2; k++)
+            if (fd[k] >= 0)
+                close(fd[k]);
+#endif
+    }
+
+    bool available() const {return fd[0] >= 0 && fd[1] >= 0;}
+
+    /* runs f() reps times and returns the misses of one call */
+    template<typename F>
+    void measure(int reps, F f, double &l1_misses, double &ll_misses)
+    {
+        long long counts[2] = {0, 0};
+#ifdef __linux__
+        if (available())
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                ioctl(fd[k], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd[k], PERF_EVENT_IOC_ENABLE, 0);
+            }
+            for (int i = 0; i < reps; i++)
+                f();
+            for (int k = 0; k < 2; k++)
+            {
+                ioctl(fd[k], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd[k], &counts[k], sizeof(counts[k])) != sizeof(counts[k]))
+                    counts[k] = 0;
+            }
+        }
+#endif
+        l1_misses = (double)counts[0] / reps;
+        ll_misses = (double)counts[1] / reps;
+    }
+
+private:
+    int fd[2] = {-1, -1};
+};
+
+void printPass(const char* name, double ms, double bytes)
+{
+    std::printf("  %-28s %10.3f ms  %8.1f MB/pass  %7.2f GB/s\n", name, ms, bytes / 1e6, bytes / (ms * 1e6));
+}
+
+#define RENDER_LOOP_RATE 120 // the frames per second of the display simulated by runRenderLoop()
+#define RENDER_LOOP_SECONDS 1.0 // how long runRenderLoop() runs, at least 3 frames
+
+struct RenderLoopStats
+{
+    double mean_ms = 0.0, max_ms = 0.0; // the time from the start of a frame to its vertices
+    int frames = 0;
+    double seconds = 0.0; // the whole loop, the waits for the next frame included
+};
+
+/* a render loop paced at RENDER_LOOP_RATE frames per second: frame(elapsed) gets the real time since the previous frame
+and builds the vertices of the frame, then the loop waits for the next frame of the display */
+template<typename F>
+RenderLoopStats runRenderLoop(F frame)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / RENDER_LOOP_RATE));
+    RenderLoopStats stats;
+    const Clock::time_point start = Clock::now();
+    Clock::time_point previous = start, deadline = start;
+    while (stats.frames < 3 || Clock::now() - start < std::chrono::duration<double>(RENDER_LOOP_SECONDS))
+    {
+        const Clock::time_point begin = Clock::now();
+        frame(std::chrono::duration<float>(begin - previous).count());
+        previous = begin;
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+        stats.mean_ms += ms;
+        stats.max_ms = std::max(stats.max_ms, ms);
+        stats.frames++;
+        deadline = std::max(deadline + period, Clock::now()); // a late frame starts the next one at once
+        std::this_thread::sleep_until(deadline);
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    stats.mean_ms /= stats.frames;
+    return stats;
+}
+
+void benchmarkGrid(int n)
+{
+    const double count = (double)n * n;
+    const int reps = n <= 100 ? 200 : (n <= 500 ? 20 : 2);
+    std::printf("grid %dx%d (%d particles)\n", n, n, n * n);
+
+    // legacy array of structures passes
+    std::vector<LegacyParticle> legacy(n * n, LegacyParticle{true, MASS, Vec3(0,0,0), Vec3(0,0,0), Vec3(0,0,0), Vec3(0,0,0)});
+    double ms = timeMs(reps, [&]() {
+        for (LegacyParticle& p : legacy)
+            p.acceleration += Vec3(0, -1e-4f, 0) / p.mass;
+    });
+    printPass("AoS gravity", ms, count * sizeof(LegacyParticle) * 2);
+    ms = timeMs(reps, [&]() {
+        for (LegacyParticle& p : legacy)
+        {
+            if (p.movable)
+            {
+                Vec3 temp = p.pos;
+                p.pos = p.pos + (p.pos - p.old_pos) * (1.0 - DAMPING) + p.acceleration * TIME_STEPSIZE2;
+                p.old_pos = temp;
+                p.acceleration = Vec3(0,0,0);
+            }
+        }
+    });
+    printPass("AoS integration", ms, count * sizeof(LegacyParticle) * 2);
+
+    // structure of arrays passes
+    Flag flag(3.5f, 3.0f, n, n);
+    ParticleStore store;
+    store.resize(n * n);
+    ms = timeMs(reps, [&]() { store.addForceAll(Vec3(0, -1e-4f, 0)); });
+    printPass("SoA gravity", ms, count * 3 * sizeof(float) * 2);
+    ms = timeMs(reps, [&]() { store.timeStep(); });
+    printPass("SoA integration", ms, count * (9 * sizeof(float) * 2 + 1.0 / 8));
+    const double separate = timeMs(reps, [&]() { store.addForceAll(Vec3(0, -1e-4f, 0)); store.timeStep(); });
+    const auto gravity = makeForcePipeline(GravityField(Vec3(0, -1e-4f, 0)));
+    ms = timeMs(reps, [&]() { store.timeStep(gravity); });
+    printPass("SoA fused gravity integration", ms, count * (9 * sizeof(float) * 2 + 1.0 / 8));
+    std::printf("  x%.2f against the gravity pass then the integration\n", separate / ms);
+    const auto fields = makeForcePipeline(GravityField(Vec3(0, -1e-4f, 0)), DragField(1e-3f));
+    ms = timeMs(reps, [&]() { store.timeStep(fields); });
+    printPass("SoA fused gravity + drag integration", ms, count * (9 * sizeof(float) * 2 + 1.0 / 8));
+
+    ms = timeMs(reps, [&]() { flag.addwindForce(Vec3(1, 0, 1)); });
+    printPass("SoA wind", ms, count * (3 + 3 * 2) * sizeof(float));
+    ms = timeMs(reps, [&]() { flag.updateNormals(); flag.buildVertices(); });
+    printPass("SoA normals + vertices", ms, count * (3 + 3 * 2) * sizeof(float) + count * 6 * sizeof(float));
+
+    // the vertices written in each VertexFormat, the bytes uploaded per frame by render()
+    const char *format_names[4] = {"vertices packed Float", "vertices packed Half", "vertices packed Quantized", "vertices packed Position"};
+    for (VertexFormat format : {VertexFormat::Float, VertexFormat::Half, VertexFormat::Quantized, VertexFormat::Position})
+    {
+        const ParticleStore &source = flag.getParticles();
+        std::vector<unsigned char> packed((size_t)n * n * vertexSize(format));
+        VertexPacker packer(format);
+        const float minimum[3] = {-1, -1, -1}, maximum[3] = {5, 5, 5};
+        packer.fit(minimum, maximum);
+        ms = timeMs(reps, [&]() {
+            unsigned char *vertex = packed.data();
+            for (int i = 0; i < n * n; i++)
+                packer.store(source.pos_x[i], source.pos_y[i], source.pos_z[i], source.normal_x[i], source.normal_y[i], source.normal_z[i], vertex);
+        });
+        printPass(format_names[(int)format], ms, count * 6 * sizeof(float) + count * vertexSize(format));
+    }
+
+    // the normals scattered to the corners of every triangle and normalized at each contribution, against the triangle cache and the gathered normals
+    ParticleStore scattered = flag.getParticles();
+    const double scatter = timeMs(reps, [&]() {
+        scattered.resetNormals();
+        for (int y = 0; y < n - 1; y++)
+        {
+            for (int x = 0; x < n - 1; x++)
+            {
+                const int i = y * n + x;
+                Vec3 p1 = scattered.getPos(i), p2 = scattered.getPos(i + 1), p3 = scattered.getPos(i + n), p4 = scattered.getPos(i + n + 1);
+                Vec3 normal = (p1 - p2).cross(p3 - p2);
+                scattered.addToNormal(i + n + 1, normal); scattered.addToNormal(i + 1, normal); scattered.addToNormal(i, normal);
+                normal = (p2 - p4).cross(p3 - p4);
+                scattered.addToNormal(i + n + 1, normal); scattered.addToNormal(i, normal); scattered.addToNormal(i + n, normal);
+            }
+        }
+    });
+    printPass("scattered normals", scatter, count * (3 + 3 * 2 * 3) * sizeof(float));
+    TriangleCache triangles;
+    const GridLayout row_major(n, n, ParticleLayout::RowMajor);
+    const double build = timeMs(reps, [&]() { triangles.build(flag.getParticles(), row_major, n, n); });
+    printPass("triangle cache", build, count * (3 + 2 * 6) * sizeof(float));
+    const int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int threads : {1, hardware_threads})
+    {
+        flag.setNumThreads(threads);
+        ms = timeMs(reps, [&]() { flag.updateNormals(); }); // the cache of the flag is already filled
+        char name[64];
+        std::snprintf(name, sizeof(name), "gathered normals %d threads", threads);
+        printPass(name, ms, count * (2 * 3 + 3) * sizeof(float));
+        if (threads == 1)
+            std::printf("  x%.2f against the scattered normals, the triangle cache included\n", scatter / (build + ms));
+        if (hardware_threads == 1)
+            break;
+    }
+    flag.setNumThreads(hardware_threads);
+
+    // constraint solver, the sequential loop against the vectorized kernel
+    const int steps = n <= 100 ? 20 : 1;
+    flag.setSolverMode(SolverMode::Sequential);
+    const double sequential = timeMs(steps, [&]() { flag.timeStep(); });
+    printPass("timeStep sequential", sequential, count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    std::printf("  %d constraints of %d bytes (%.1f MB)\n", flag.getNumConstraints(), (int)sizeof(Constraint),
+                flag.getNumConstraints() * sizeof(Constraint) / 1e6);
+    flag.setSolverMode(SolverMode::Batched);
+    const double batched = timeMs(steps, [&]() { flag.timeStep(); });
+    printPass("timeStep batched", batched, count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    std::printf("  batched speedup x%.2f (%d constraints per batch)\n", sequential / batched, CONSTRAINT_BATCH_WIDTH);
+
+    // parallel solvers, from one thread to every hardware thread
+    const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (SolverMode mode : {SolverMode::Colored, SolverMode::Jacobi})
+    {
+        flag.setSolverMode(mode);
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            flag.setNumThreads(threads);
+            const double parallel = timeMs(steps, [&]() { flag.timeStep(); });
+            char name[64];
+            std::snprintf(name, sizeof(name), "timeStep %s %d threads", mode == SolverMode::Colored ? "colored" : "jacobi", threads);
+            printPass(name, parallel, count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+        }
+    }
+    std::printf("  %d colors\n", flag.getNumColors());
+
+    // stencil solver, no constraint stored
+    Flag stencil_flag(3.5f, 3.0f, n, n);
+    stencil_flag.setSolverMode(SolverMode::Stencil);
+    ms = timeMs(steps, [&]() { stencil_flag.timeStep(); });
+    printPass("timeStep stencil", ms, count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    std::printf("  stencil speedup x%.2f over sequential, %d constraints stored\n", sequential / ms, stencil_flag.getNumConstraints());
+
+    // the same sweeps with temporal blocking, compared to the stencil flag after the same number of steps
+    Flag blocked_flag(3.5f, 3.0f, n, n);
+    blocked_flag.setSolverMode(SolverMode::Blocked);
+    const double blocked = timeMs(steps, [&]() { blocked_flag.timeStep(); });
+    float max_difference = 0.0f;
+    for (int i = 0; i < n * n; i++)
+        max_difference = std::max(max_difference, (blocked_flag.getParticles().getPos(i) - stencil_flag.getParticles().getPos(i)).length());
+    printPass("timeStep blocked", blocked, count * 3 * sizeof(float) * 2);
+    std::printf("  blocked speedup x%.2f over stencil, largest distance to the stencil result %g\n", ms / blocked, max_difference);
+
+    // coarse grids or Chebyshev acceleration with the stencil sweeps, the flags fall under gravity and wind,
+    // the stretch left after the same steps tells how far each solver converged
+    Flag sag_flags[4] = {Flag(3.5f, 3.0f, n, n), Flag(3.5f, 3.0f, n, n), Flag(3.5f, 3.0f, n, n), Flag(3.5f, 3.0f, n, n)};
+    sag_flags[0].setSolverMode(SolverMode::Stencil);
+    sag_flags[1].setSolverMode(SolverMode::Multigrid);
+    sag_flags[2].setSolverMode(SolverMode::Stencil);
+    sag_flags[2].setChebyshev(true);
+    sag_flags[3].setSolverMode(SolverMode::Stencil);
+    sag_flags[3].setTolerance(1e-3f, CONSTRAINT_ITERATIONS, 1e-3f);
+    double sag_ms[4], mean_stretch[4];
+    int total_iterations = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        Flag &f = sag_flags[k];
+        sag_ms[k] = timeMs(steps, [&]() {
+            f.addForce(Vec3(0, -9.81f / count, 0));
+            f.addwindForce(Vec3(1, 0, 1));
+            f.timeStep();
+            total_iterations += f.getIterations();
+        });
+        double stretch = 0;
+        for (int y = 0; y < n; y++)
+            for (int x = 0; x + 1 < n; x++)
+                stretch += fabs((f.getParticles().getPos(y * n + x + 1) - f.getParticles().getPos(y * n + x)).length() / (3.5f / n) - 1);
+        mean_stretch[k] = stretch / (n * (n - 1));
+    }
+    printPass("frame multigrid", sag_ms[1], count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    std::printf("  %d levels, x%.2f the stencil time, mean stretch %.4f against %.4f for the stencil\n",
+                sag_flags[1].getNumLevels(), sag_ms[1] / sag_ms[0], mean_stretch[1], mean_stretch[0]);
+    printPass("frame stencil chebyshev", sag_ms[2], count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    std::printf("  spectral radius %.3f, x%.2f the stencil time, mean stretch %.4f against %.4f for the stencil\n",
+                sag_flags[2].getSpectralRadius(), sag_ms[2] / sag_ms[0], mean_stretch[2], mean_stretch[0]);
+    total_iterations -= 3 * steps * CONSTRAINT_ITERATIONS; // the first three flags always run every iteration
+    printPass("frame stencil early exit", sag_ms[3], count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    std::printf("  %.1f iterations per step, x%.2f the stencil time, mean stretch %.4f against %.4f for the stencil\n",
+                (double)total_iterations / steps, sag_ms[3] / sag_ms[0], mean_stretch[3], mean_stretch[0]);
+
+    // a flag at rest falls asleep after SLEEP_FRAMES still steps, then the frames skip it
+    for (int sleeping = 0; sleeping < 2; sleeping++)
+    {
+        Flag rest_flag(3.5f, 3.0f, n, n);
+        rest_flag.setSolverMode(SolverMode::Stencil);
+        rest_flag.setSleeping(sleeping != 0);
+        auto frame = [&]() {
+            rest_flag.addForce(Vec3(0, 0, 0));
+            rest_flag.addwindForce(Vec3(0, 0, 0));
+            rest_flag.timeStep();
+            rest_flag.updateNormals();
+        };
+        for (int i = 0; i <= SLEEP_FRAMES; i++)
+            frame();
+        ms = timeMs(steps, frame);
+        printPass(sleeping ? "frame at rest, sleeping" : "frame at rest", ms, count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+        if (sleeping)
+            std::printf("  %d of %d tiles asleep\n", rest_flag.getNumSleepingTiles(), rest_flag.getNumTiles());
+    }
+
+    // extended position based dynamics, XPBD_SUBSTEPS substeps of XPBD_ITERATIONS iterations
+    flag.setSolverMode(SolverMode::Xpbd);
+    ms = timeMs(steps, [&]() { flag.timeStep(); });
+    printPass("timeStep xpbd", ms, count * 3 * sizeof(float) * 2 * XPBD_SUBSTEPS * XPBD_ITERATIONS);
+    std::printf("  xpbd speedup x%.2f over sequential (%d substeps of %d iterations against %d iterations)\n",
+                sequential / ms, XPBD_SUBSTEPS, XPBD_ITERATIONS, CONSTRAINT_ITERATIONS);
+
+    // a whole frame with its phases in sequence, then as a graph of band tasks on every thread
+    for (int piped = 0; piped < 2; piped++)
+    {
+        Flag frame_flag(3.5f, 3.0f, n, n);
+        frame_flag.setSolverMode(SolverMode::Stencil);
+        frame_flag.setPipelined(piped != 0);
+        frame_flag.simulateFrame(Vec3(0, -1e-4f, 0), Vec3(1, 0, 1)); // builds the graph
+        ms = timeMs(steps, [&]() { frame_flag.simulateFrame(Vec3(0, -1e-4f, 0), Vec3(1, 0, 1)); });
+        printPass(piped ? "frame task graph" : "frame phases in sequence", ms, count * 3 * sizeof(float) * 2 * CONSTRAINT_ITERATIONS);
+    }
+
+    // the latency of the frames of a render loop, serial or with the simulation thread
+    Flag serial_flag(3.5f, 3.0f, n, n);
+    serial_flag.setSolverMode(SolverMode::Stencil);
+    serial_flag.setInterpolation(true);
+    FixedStepClock sim_clock;
+    long long serial_steps = 0;
+    RenderLoopStats serial = runRenderLoop([&](float elapsed) {
+        const int num_steps = sim_clock.advance(elapsed);
+        for (int step = 0; step < num_steps; step++)
+        {
+            serial_flag.addwindForce(Vec3(1, 0, 1));
+            serial_flag.timeStep(makeForcePipeline(GravityField(Vec3(0, -1e-4f, 0))));
+        }
+        serial_steps += num_steps;
+        serial_flag.updateNormals();
+        serial_flag.buildVertices(sim_clock.alpha());
+    });
+    Flag threaded_flag(3.5f, 3.0f, n, n);
+    threaded_flag.setSolverMode(SolverMode::Stencil);
+    threaded_flag.setInterpolation(true);
+    SimulationThread<Flag> simulation(threaded_flag, [](Flag &f) {
+        f.addwindForce(Vec3(1, 0, 1));
+        f.timeStep(makeForcePipeline(GravityField(Vec3(0, -1e-4f, 0))));
+    });
+    simulation.start();
+    RenderLoopStats threaded = runRenderLoop([&](float) {
+        threaded_flag.buildVertices(simulation.latest(), simulation.alpha());
+    });
+    const long long threaded_steps = simulation.latest().steps;
+    simulation.stop();
+    std::printf("render loop at %d Hz, %d hardware threads:\n", RENDER_LOOP_RATE, (int)std::thread::hardware_concurrency());
+    std::printf("  serial              frame %8.3f ms (max %8.3f), %6.1f frames/s, %6.1f steps/s\n",
+                serial.mean_ms, serial.max_ms, serial.frames / serial.seconds, serial_steps / serial.seconds);
+    std::printf("  simulation thread   frame %8.3f ms (max %8.3f), %6.1f frames/s, %6.1f steps/s on the thread (target %d)\n",
+                threaded.mean_ms, threaded.max_ms, threaded.frames / threaded.seconds, threaded_steps / threaded.seconds, SIMULATION_RATE);
+}
+
+/* the same frame with the particles stored row major, along a Morton curve and in square tiles */
+void benchmarkLayouts(int n, CacheCounters &counters)
+{
+    const int reps = n <= 100 ? 50 : (n <= 500 ? 5 : 1);
+    const char *names[3] = {"row major", "morton", "tiled"};
+    const ParticleLayout layouts[3] = {ParticleLayout::RowMajor, ParticleLayout::Morton, ParticleLayout::Tiled};
+    std::printf("layouts %dx%d\n", n, n);
+    for (int k = 0; k < 3; k++)
+    {
+        Flag flag(3.5f, 3.0f, n, n, 1);
+        flag.setParticleLayout(layouts[k]);
+        flag.setSolverMode(SolverMode::Sequential);
+        auto frame = [&]() {
+            flag.addwindForce(Vec3(1, 0, 1));
+            flag.timeStep();
+            flag.updateNormals();
+        };
+        frame(); // builds the constraints
+        const double ms = timeMs(reps, frame);
+        if (counters.available())
+        {
+            double l1_misses, ll_misses;
+            counters.measure(reps, frame, l1_misses, ll_misses);
+            std::printf("  %-10s %10.3f ms/frame  L1d misses %12.0f  LL misses %10.0f\n", names[k], ms, l1_misses, ll_misses);
+        }
+        else
+        {
+            std::printf("  %-10s %10.3f ms/frame  L1d misses n/a  LL misses n/a\n", names[k], ms);
+        }
+    }
+}
+
+/* the compile-time sized flag against the generic Flag running the same stencil solver */
+template<int N>
+void benchmarkFixed()
+{
+    const int reps = 200;
+    Flag flag(3.5f, 3.0f, N, N);
+    flag.setSolverMode(SolverMode::Stencil);
+    std::unique_ptr<FixedFlag<N, N>> fixed(new FixedFlag<N, N>(3.5f, 3.0f));
+    const float gravity = -9.81f / (N * N);
+
+    const double generic = timeMs(reps, [&]() {
+        flag.addForce(Vec3(0, gravity, 0));
+        flag.addwindForce(Vec3(1, 0, 1));
+        flag.timeStep();
+        flag.updateNormals();
+    });
+    const double specialised = timeMs(reps, [&]() {
+        fixed->addForce(Vec3(0, gravity, 0));
+        fixed->addwindForce(Vec3(1, 0, 1));
+        fixed->timeStep();
+        fixed->updateNormals();
+    });
+    std::printf("fixed grid %dx%d : Flag %8.3f ms/frame, FixedFlag %8.3f ms/frame, x%.2f\n", N, N, generic, specialised, generic / specialised);
+}
+
+/* a scene of many flags of different sizes, a few large ones among them, on one thread then on every thread */
+void benchmarkWorld(int num_flags)
+{
+    const int sizes[4] = {16, 32, 64, 256};
+    int num_threads[2] = {1, (int)std::thread::hardware_concurrency()};
+    std::printf("world of %d flags\n", num_flags);
+    for (int t = 0; t < (num_threads[1] > 1 ? 2 : 1); t++)
+    {
+        FlagWorld world(num_threads[t]);
+        for (int i = 0; i < num_flags; i++)
+        {
+            const int n = sizes[i % 16 == 0 ? 3 : i % 3];
+            const int index = world.addFlag(3.5f, 3.0f, n, n);
+            world.setForces(index, Vec3(0, -0.05f / (n * n), 0), Vec3(1, 0, 1));
+        }
+        world.timeStep(); // builds the solvers
+        const double ms = timeMs(3, [&]() { world.timeStep(); });
+        std::printf("  %2d threads %10.3f ms/step  %8.2f M particle-steps/s  (%lld particles)\n",
+                    world.numThreads(), ms, world.numParticles() / ms * 1e-3, world.numParticles());
+    }
+}
+
+/* a single large flag in a world: its constraint sweeps are split in bands, so the threads share it */
+void benchmarkLargeFlag(int n)
+{
+    int num_threads[2] = {1, (int)std::thread::hardware_concurrency()};
+    std::printf("world of one %dx%d flag\n", n, n);
+    for (int t = 0; t < (num_threads[1] > 1 ? 2 : 1); t++)
+    {
+        FlagWorld world(num_threads[t]);
+        world.setForces(world.addFlag(3.5f, 3.0f, n, n), Vec3(0, -0.05f / (n * n), 0), Vec3(1, 0, 1));
+        world.timeStep();
+        const double ms = timeMs(3, [&]() { world.timeStep(); });
+        std::printf("  %2d threads %10.3f ms/step  %8.2f M particle-steps/s\n", world.numThreads(), ms, world.numParticles() / ms * 1e-3);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(std::atoi(argv[i]));
+    if (sizes.empty())
+        sizes = {100, 500, 2000};
+
+    for (int n : sizes)
+        benchmarkGrid(n);
+
+    CacheCounters counters;
+    for (int n : sizes)
+        benchmarkLayouts(n, counters);
+
+    benchmarkWorld(200);
+    benchmarkLargeFlag(512);
+
+    benchmarkFixed<32>();
+    benchmarkFixed<64>();
+    benchmarkFixed<100>();
+    return 0;
+}
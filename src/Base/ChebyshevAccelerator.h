@@ -0,0 +1,96 @@
+#ifndef CHEBYSHEV_ACCELERATOR_H
+#define CHEBYSHEV_ACCELERATOR_H
+
+#include <Base/ParticleStore.h>
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#define CHEBYSHEV_DELAY 3 // iterations run without acceleration at the start of each time step, they also measure the spectral radius
+#define CHEBYSHEV_MAX_RADIUS 0.99f // a larger estimate of the spectral radius makes the acceleration diverge
+
+/* Chebyshev semi-iterative acceleration of the constraint iterations of a time step (Wang 2015, "A Chebyshev Semi-Iterative
+Approach for Accelerating Projective and Position-based Dynamics"). After each iteration the new positions are extrapolated
+from the positions of the two previous iterations with a weight omega that grows along the iterations:
+q(k+1) = omega * (gamma * (q^(k+1) - q(k)) + q(k) - q(k-1)) + q(k-1)
+The spectral radius rho of the iterations, which sets omega, is estimated automatically: the first CHEBYSHEV_DELAY iterations
+of a time step are not accelerated and the ratio of the sizes of their last two corrections is averaged over the time steps.
+gamma is the over-relaxation factor of each iteration, 1 keeps the corrections of the solver as they are.
+*/
+class ChebyshevAccelerator
+{
+public:
+	float over_relaxation = 1.0f; // gamma
+
+	float spectralRadius() const {return spectral_radius;}
+
+	/* called before the first iteration of a time step */
+	void begin(const ParticleStore &particles)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			current[c] = position(particles, c);
+			previous[c] = current[c];
+		}
+		omega = 1.0f;
+		last_correction = 0.0;
+	}
+
+	/* called after the iteration k of the time step, with the positions the solver computed from the positions of the iteration k-1 */
+	void accelerate(ParticleStore &particles, int k)
+	{
+		const int count = particles.size();
+		if (k < CHEBYSHEV_DELAY)
+		{
+			// plain iterations, the size of the corrections gives the spectral radius
+			double correction = 0.0;
+			for (int c = 0; c < 3; c++)
+			{
+				const float *q = position(particles, c).data();
+				const float *q_k = current[c].data();
+				for (int i = 0; i < count; i++)
+					correction += (double)(q[i] - q_k[i]) * (q[i] - q_k[i]);
+			}
+			if (k == CHEBYSHEV_DELAY - 1 && last_correction > 0.0)
+			{
+				const float rho = std::min((float)sqrt(correction / last_correction), CHEBYSHEV_MAX_RADIUS);
+				spectral_radius = spectral_radius == 0.0f ? rho : spectral_radius * 0.9f + rho * 0.1f;
+			}
+			last_correction = correction;
+			for (int c = 0; c < 3; c++)
+			{
+				previous[c].swap(current[c]);
+				current[c] = position(particles, c);
+			}
+			return;
+		}
+
+		const float rho2 = spectral_radius * spectral_radius;
+		omega = k == CHEBYSHEV_DELAY ? 2.0f / (2.0f - rho2) : 4.0f / (4.0f - rho2 * omega);
+		const float gamma = over_relaxation;
+		for (int c = 0; c < 3; c++)
+		{
+			float *q = position(particles, c).data();
+			const float *q_k = current[c].data();
+			float *q_k1 = previous[c].data(); // q(k-1), overwritten by q(k+1)
+			for (int i = 0; i < count; i++)
+			{
+				q[i] = omega * (gamma * (q[i] - q_k[i]) + q_k[i] - q_k1[i]) + q_k1[i];
+				q_k1[i] = q[i];
+			}
+			previous[c].swap(current[c]); // current is q(k+1), previous is q(k)
+		}
+	}
+
+private:
+	std::vector<float> current[3]; // the positions after the previous iteration, q(k)
+	std::vector<float> previous[3]; // the positions one iteration before, q(k-1)
+	float omega = 1.0f;
+	float spectral_radius = 0.0f; // 0 until the first estimate, the acceleration is then a plain iteration
+	double last_correction = 0.0;
+
+	static std::vector<float> &position(ParticleStore &particles, int c) {return c == 0 ? particles.pos_x : (c == 1 ? particles.pos_y : particles.pos_z);}
+	static const std::vector<float> &position(const ParticleStore &particles, int c) {return c == 0 ? particles.pos_x : (c == 1 ? particles.pos_y : particles.pos_z);}
+};
+#endif
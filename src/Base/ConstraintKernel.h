@@ -0,0 +1,377 @@
+#ifndef CONSTRAINT_KERNEL_H
+#define CONSTRAINT_KERNEL_H
+
+#include <Base/ParticleStore.h>
+#include <Base/ThreadPool.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+// number of constraints solved by one instruction of the vectorized kernel
+#if defined(__AVX512F__)
+#define CONSTRAINT_BATCH_WIDTH 16
+#else
+#define CONSTRAINT_BATCH_WIDTH 8
+#endif
+
+#define MAX_REST_LENGTHS 8 // the grid produces at most 6 distinct rest lengths, 8 fit in one AVX2 register
+
+/* The distinct rest lengths of the constraints of a Flag, a constraint only stores the 8 bits id of its rest length */
+class RestLengthTable
+{
+public:
+	float length[MAX_REST_LENGTHS] = {};
+	int count = 0;
+
+	/* returns the id of rest_length, adding it to the table if it is not there yet */
+	uint8_t add(float rest_length)
+	{
+		for (int id = 0; id < count; id++)
+		{
+			if (length[id] == rest_length)
+				return (uint8_t)id;
+		}
+		assert(count < MAX_REST_LENGTHS);
+		length[count] = rest_length;
+		return (uint8_t)count++;
+	}
+
+	float operator[](uint8_t id) const {return length[id];}
+};
+
+/* The same correction as Constraint::satisfyConstraint(), for the constraint between the particles p1 and p2,
+returns the relative violation of the constraint before the correction */
+inline float satisfyConstraintScalar(ParticleStore &particles, int p1, int p2, float rest_distance)
+{
+	Vec3 p1_to_p2 = particles.getPos(p2)-particles.getPos(p1);
+	float current_distance = p1_to_p2.length();
+	float violation = 1 - rest_distance/current_distance;
+	Vec3 correctionVectorHalf = p1_to_p2*violation*0.5;
+	particles.offsetPos(p1, correctionVectorHalf);
+	particles.offsetPos(p2, -correctionVectorHalf);
+	return fabsf(violation);
+}
+
+/* satisfyConstraintScalar() when the particle held must stay where it is, as if it were pinned: only the particle moving gets its half
+of the correction. The solvers hold the particles of the sleeping tiles they skip (see SleepTracker.h) */
+inline float satisfyConstraintHeld(ParticleStore &particles, int moving, int held, float rest_distance)
+{
+	Vec3 held_to_moving = particles.getPos(moving)-particles.getPos(held);
+	float current_distance = held_to_moving.length();
+	float violation = 1 - rest_distance/current_distance;
+	Vec3 correctionVectorHalf = held_to_moving*violation*0.5;
+	particles.offsetPos(moving, -correctionVectorHalf);
+	return fabsf(violation);
+}
+
+#if defined(__AVX512F__)
+/* solves 16 constraints that share no particle: the positions are gathered, 1/distance comes from rsqrt refined by one Newton step,
+and the corrected positions are scattered back only to the movable particles */
+inline void satisfyConstraintsSimd(ParticleStore &particles, const uint32_t *p1, const uint32_t *p2, const uint8_t *rest_id, const RestLengthTable &rest_lengths)
+{
+	const __m512i i1 = _mm512_loadu_si512(p1);
+	const __m512i i2 = _mm512_loadu_si512(p2);
+	// every intrinsic below has its inactive lanes defined (masked with all the lanes, from zero): the forms without a mask
+	// take their pass-through from _mm512_undefined_*(), which GCC 12 reports as maybe uninitialized
+	const __mmask16 ALL_LANES = 0xFFFF;
+	const __m512 zero = _mm512_setzero_ps();
+	const __m512 x1 = _mm512_mask_i32gather_ps(zero, ALL_LANES, i1, particles.pos_x.data(), 4);
+	const __m512 y1 = _mm512_mask_i32gather_ps(zero, ALL_LANES, i1, particles.pos_y.data(), 4);
+	const __m512 z1 = _mm512_mask_i32gather_ps(zero, ALL_LANES, i1, particles.pos_z.data(), 4);
+	const __m512 x2 = _mm512_mask_i32gather_ps(zero, ALL_LANES, i2, particles.pos_x.data(), 4);
+	const __m512 y2 = _mm512_mask_i32gather_ps(zero, ALL_LANES, i2, particles.pos_y.data(), 4);
+	const __m512 z2 = _mm512_mask_i32gather_ps(zero, ALL_LANES, i2, particles.pos_z.data(), 4);
+
+	const __m512 dx = _mm512_sub_ps(x2, x1);
+	const __m512 dy = _mm512_sub_ps(y2, y1);
+	const __m512 dz = _mm512_sub_ps(z2, z1);
+	const __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+	// r = 1/sqrt(d2), one Newton-Raphson step brings the 14 bits estimate to full float precision
+	__m512 r = _mm512_maskz_rsqrt14_ps(ALL_LANES, d2);
+	r = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), r),
+	                  _mm512_fnmadd_ps(_mm512_mul_ps(d2, r), r, _mm512_set1_ps(3.0f)));
+
+	// half of (1 - rest_distance/current_distance), the rest distances are looked up in the table held by one register
+	const __m512 rest_distance = _mm512_maskz_permutexvar_ps(ALL_LANES, _mm512_maskz_cvtepu8_epi32(ALL_LANES, _mm_loadu_si128((const __m128i*)rest_id)),
+	                                                         _mm512_maskz_loadu_ps(0x00FF, rest_lengths.length)); // the 8 lengths, the upper lanes zero
+	const __m512 s = _mm512_mul_ps(_mm512_set1_ps(0.5f),
+	                               _mm512_fnmadd_ps(rest_distance, r, _mm512_set1_ps(1.0f)));
+	const __m512 cx = _mm512_mul_ps(dx, s);
+	const __m512 cy = _mm512_mul_ps(dy, s);
+	const __m512 cz = _mm512_mul_ps(dz, s);
+
+	// a particle is movable when its bit of the pinned bitmask is clear
+	const int *pinned = (const int*)particles.pinned.data();
+	const __m512i bit = _mm512_set1_epi32(31);
+	const __m512i w1 = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), ALL_LANES, _mm512_maskz_srli_epi32(ALL_LANES, i1, 5), pinned, 4);
+	const __m512i w2 = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), ALL_LANES, _mm512_maskz_srli_epi32(ALL_LANES, i2, 5), pinned, 4);
+	const __mmask16 movable1 = _mm512_testn_epi32_mask(_mm512_maskz_srlv_epi32(ALL_LANES, w1, _mm512_and_si512(i1, bit)), _mm512_set1_epi32(1));
+	const __mmask16 movable2 = _mm512_testn_epi32_mask(_mm512_maskz_srlv_epi32(ALL_LANES, w2, _mm512_and_si512(i2, bit)), _mm512_set1_epi32(1));
+
+	_mm512_mask_i32scatter_ps(particles.pos_x.data(), movable1, i1, _mm512_add_ps(x1, cx), 4);
+	_mm512_mask_i32scatter_ps(particles.pos_y.data(), movable1, i1, _mm512_add_ps(y1, cy), 4);
+	_mm512_mask_i32scatter_ps(particles.pos_z.data(), movable1, i1, _mm512_add_ps(z1, cz), 4);
+	_mm512_mask_i32scatter_ps(particles.pos_x.data(), movable2, i2, _mm512_sub_ps(x2, cx), 4);
+	_mm512_mask_i32scatter_ps(particles.pos_y.data(), movable2, i2, _mm512_sub_ps(y2, cy), 4);
+	_mm512_mask_i32scatter_ps(particles.pos_z.data(), movable2, i2, _mm512_sub_ps(z2, cz), 4);
+}
+#elif defined(__AVX2__)
+/* solves 8 constraints that share no particle: the positions are gathered, 1/distance comes from rsqrt refined by one Newton step.
+AVX2 has no scatter, pinned particles get their gathered position back through a blend before the lanes are stored one by one */
+inline void satisfyConstraintsSimd(ParticleStore &particles, const uint32_t *p1, const uint32_t *p2, const uint8_t *rest_id, const RestLengthTable &rest_lengths)
+{
+	const __m256i i1 = _mm256_loadu_si256((const __m256i*)p1);
+	const __m256i i2 = _mm256_loadu_si256((const __m256i*)p2);
+	const __m256 x1 = _mm256_i32gather_ps(particles.pos_x.data(), i1, 4);
+	const __m256 y1 = _mm256_i32gather_ps(particles.pos_y.data(), i1, 4);
+	const __m256 z1 = _mm256_i32gather_ps(particles.pos_z.data(), i1, 4);
+	const __m256 x2 = _mm256_i32gather_ps(particles.pos_x.data(), i2, 4);
+	const __m256 y2 = _mm256_i32gather_ps(particles.pos_y.data(), i2, 4);
+	const __m256 z2 = _mm256_i32gather_ps(particles.pos_z.data(), i2, 4);
+
+	const __m256 dx = _mm256_sub_ps(x2, x1);
+	const __m256 dy = _mm256_sub_ps(y2, y1);
+	const __m256 dz = _mm256_sub_ps(z2, z1);
+	const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
+
+	// r = 1/sqrt(d2), one Newton-Raphson step brings the 12 bits estimate to full float precision
+	__m256 r = _mm256_rsqrt_ps(d2);
+	r = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), r),
+	                  _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_mul_ps(d2, r), r)));
+
+	// half of (1 - rest_distance/current_distance), the rest distances are looked up in the table held by one register
+	const __m256 rest_distance = _mm256_permutevar8x32_ps(_mm256_loadu_ps(rest_lengths.length),
+	                                                      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)rest_id)));
+	const __m256 s = _mm256_mul_ps(_mm256_set1_ps(0.5f),
+	                               _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(rest_distance, r)));
+	const __m256 cx = _mm256_mul_ps(dx, s);
+	const __m256 cy = _mm256_mul_ps(dy, s);
+	const __m256 cz = _mm256_mul_ps(dz, s);
+
+	// a particle is pinned when its bit of the pinned bitmask is set
+	const int *pinned = (const int*)particles.pinned.data();
+	const __m256i bit = _mm256_set1_epi32(31);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i w1 = _mm256_i32gather_epi32(pinned, _mm256_srli_epi32(i1, 5), 4);
+	const __m256i w2 = _mm256_i32gather_epi32(pinned, _mm256_srli_epi32(i2, 5), 4);
+	const __m256 pinned1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(w1, _mm256_and_si256(i1, bit)), one), one));
+	const __m256 pinned2 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(w2, _mm256_and_si256(i2, bit)), one), one));
+
+	alignas(32) float out[6][8];
+	_mm256_store_ps(out[0], _mm256_blendv_ps(_mm256_add_ps(x1, cx), x1, pinned1));
+	_mm256_store_ps(out[1], _mm256_blendv_ps(_mm256_add_ps(y1, cy), y1, pinned1));
+	_mm256_store_ps(out[2], _mm256_blendv_ps(_mm256_add_ps(z1, cz), z1, pinned1));
+	_mm256_store_ps(out[3], _mm256_blendv_ps(_mm256_sub_ps(x2, cx), x2, pinned2));
+	_mm256_store_ps(out[4], _mm256_blendv_ps(_mm256_sub_ps(y2, cy), y2, pinned2));
+	_mm256_store_ps(out[5], _mm256_blendv_ps(_mm256_sub_ps(z2, cz), z2, pinned2));
+	for (int lane = 0; lane < 8; lane++)
+	{
+		particles.pos_x[p1[lane]] = out[0][lane];
+		particles.pos_y[p1[lane]] = out[1][lane];
+		particles.pos_z[p1[lane]] = out[2][lane];
+		particles.pos_x[p2[lane]] = out[3][lane];
+		particles.pos_y[p2[lane]] = out[4][lane];
+		particles.pos_z[p2[lane]] = out[5][lane];
+	}
+}
+#else
+/* scalar fallback when the compiler does not target AVX2 */
+inline void satisfyConstraintsSimd(ParticleStore &particles, const uint32_t *p1, const uint32_t *p2, const uint8_t *rest_id, const RestLengthTable &rest_lengths)
+{
+	for (int lane = 0; lane < CONSTRAINT_BATCH_WIDTH; lane++)
+	{
+		satisfyConstraintScalar(particles, p1[lane], p2[lane], rest_lengths[rest_id[lane]]);
+	}
+}
+#endif
+
+/* solves count constraints where every group of CONSTRAINT_BATCH_WIDTH consecutive constraints shares no particle,
+full groups go through the vectorized kernel and the remaining ones are solved one at a time */
+inline void satisfyIndependentConstraints(ParticleStore &particles, const uint32_t *p1, const uint32_t *p2, const uint8_t *rest_id,
+                                          const RestLengthTable &rest_lengths, int count)
+{
+	int i = 0;
+	for (; i + CONSTRAINT_BATCH_WIDTH <= count; i += CONSTRAINT_BATCH_WIDTH)
+	{
+		satisfyConstraintsSimd(particles, p1 + i, p2 + i, rest_id + i, rest_lengths);
+	}
+	for (; i < count; i++)
+	{
+		satisfyConstraintScalar(particles, p1[i], p2[i], rest_lengths[rest_id[i]]);
+	}
+}
+
+/* The constraints of a Flag regrouped in batches of at most CONSTRAINT_BATCH_WIDTH constraints that share no particle,
+so that a whole batch can be solved by one call of the vectorized kernel.
+The batches follow the creation order of the constraints as closely as possible: a constraint that conflicts with the batch being filled
+is deferred to one of the following batches.
+*/
+class ConstraintBatches
+{
+public:
+	std::vector<uint32_t> p1, p2; // the particles of every constraint, in batch order
+	std::vector<uint8_t> rest_id; // the id of the rest length of every constraint
+	std::vector<int> batch_begin; // batch b holds the constraints [batch_begin[b], batch_begin[b+1])
+
+	int numBatches() const {return (int)batch_begin.size() - 1;}
+
+	/* ConstraintList is any container of constraints exposing p1, p2 and rest_id */
+	template<typename ConstraintList>
+	void build(const ConstraintList &constraints, int num_particles)
+	{
+		p1.clear();
+		p2.clear();
+		rest_id.clear();
+		batch_begin.assign(1, 0);
+
+		std::vector<int> stamp(num_particles, -1); // the last batch each particle has been added to
+		std::vector<int> deferred, still_deferred;
+		int batch = 0;
+		int size = 0;
+
+		auto tryAdd = [&](int c) -> bool
+		{
+			const int a = constraints[c].p1, b = constraints[c].p2;
+			if (stamp[a] == batch || stamp[b] == batch)
+				return false;
+			stamp[a] = stamp[b] = batch;
+			p1.push_back(a);
+			p2.push_back(b);
+			rest_id.push_back(constraints[c].rest_id);
+			size++;
+			return true;
+		};
+		auto closeBatch = [&]()
+		{
+			batch_begin.push_back((int)p1.size());
+			batch++;
+			size = 0;
+			// deferred constraints get the first places of the next batch
+			still_deferred.clear();
+			for (int c : deferred)
+			{
+				if (size == CONSTRAINT_BATCH_WIDTH || !tryAdd(c))
+					still_deferred.push_back(c);
+			}
+			deferred.swap(still_deferred);
+		};
+
+		for (int c = 0; c < (int)constraints.size(); c++)
+		{
+			if (!tryAdd(c))
+				deferred.push_back(c);
+			while (size == CONSTRAINT_BATCH_WIDTH)
+				closeBatch();
+		}
+		while (size > 0)
+			closeBatch();
+	}
+};
+
+/* The constraints of a Flag split in colors: no two constraints of the same color share a particle,
+so a color can be cut in slices solved in parallel, and every slice goes through the vectorized kernel.
+Colors are computed by a greedy coloring within each family of constraints (stretch, shear, secondary neighbours ...),
+every family gets its own colors and inside a color the constraints keep their creation order.
+*/
+class ConstraintColors
+{
+public:
+	std::vector<uint32_t> p1, p2; // the particles of every constraint, sorted by color
+	std::vector<uint8_t> rest_id; // the id of the rest length of every constraint
+	std::vector<int> color_begin; // color k holds the constraints [color_begin[k], color_begin[k+1])
+
+	int numColors() const {return (int)color_begin.size() - 1;}
+
+	/* ConstraintList is any container of constraints exposing p1, p2 and rest_id,
+	family(c) returns the family of the constraint c, between 0 and num_families-1 */
+	template<typename ConstraintList, typename Family>
+	void build(const ConstraintList &constraints, int num_particles, int num_families, Family family)
+	{
+		const int count = (int)constraints.size();
+		std::vector<int> color(count);
+		std::vector<uint64_t> used(num_particles); // bit k is set when a constraint of the current family and of color k touches the particle
+		int num_colors = 0;
+		for (int f = 0; f < num_families; f++)
+		{
+			std::fill(used.begin(), used.end(), 0);
+			int family_colors = 0;
+			for (int c = 0; c < count; c++)
+			{
+				if (family(c) != f)
+					continue;
+				const int a = constraints[c].p1, b = constraints[c].p2;
+				const uint64_t taken = used[a] | used[b];
+				int k = 0;
+				while (k < 63 && ((taken >> k) & 1u))
+					k++;
+				used[a] |= 1ull << k;
+				used[b] |= 1ull << k;
+				color[c] = num_colors + k;
+				family_colors = std::max(family_colors, k + 1);
+			}
+			num_colors += family_colors;
+		}
+
+		// stable counting sort of the constraints by color
+		color_begin.assign(num_colors + 1, 0);
+		for (int c = 0; c < count; c++)
+			color_begin[color[c] + 1]++;
+		for (int k = 0; k < num_colors; k++)
+			color_begin[k + 1] += color_begin[k];
+		std::vector<int> next(color_begin.begin(), color_begin.end() - 1);
+		p1.resize(count);
+		p2.resize(count);
+		rest_id.resize(count);
+		for (int c = 0; c < count; c++)
+		{
+			const int i = next[color[c]]++;
+			p1[i] = constraints[c].p1;
+			p2[i] = constraints[c].p2;
+			rest_id[i] = constraints[c].rest_id;
+		}
+	}
+
+	/* the slice [begin, end) of color k solved by the thread t of num_threads, slices are cut on multiples of CONSTRAINT_BATCH_WIDTH */
+	void threadRange(int k, int t, int num_threads, int &begin, int &end) const
+	{
+		const int first = color_begin[k];
+		const int batches = (color_begin[k + 1] - first + CONSTRAINT_BATCH_WIDTH - 1) / CONSTRAINT_BATCH_WIDTH;
+		begin = std::min(first + (int)((long long)batches * t / num_threads) * CONSTRAINT_BATCH_WIDTH, color_begin[k + 1]);
+		end = std::min(first + (int)((long long)batches * (t + 1) / num_threads) * CONSTRAINT_BATCH_WIDTH, color_begin[k + 1]);
+	}
+};
+
+/* solves the slices of every color that belong to the thread t of num_threads, the barrier separates two colors */
+inline void satisfyConstraintColors(ParticleStore &particles, const ConstraintColors &colors, const RestLengthTable &rest_lengths,
+                                    int t, int num_threads, SpinBarrier *barrier)
+{
+	for (int k = 0; k < colors.numColors(); k++)
+	{
+		int begin, end;
+		colors.threadRange(k, t, num_threads, begin, end);
+		if (end > begin)
+			satisfyIndependentConstraints(particles, &colors.p1[begin], &colors.p2[begin], &colors.rest_id[begin], rest_lengths, end - begin);
+		if (barrier)
+			barrier->wait();
+	}
+}
+
+/* solves every batch once, in order */
+inline void satisfyConstraintBatches(ParticleStore &particles, const ConstraintBatches &batches, const RestLengthTable &rest_lengths)
+{
+	for (int b = 0; b < batches.numBatches(); b++)
+	{
+		const int begin = batches.batch_begin[b];
+		satisfyIndependentConstraints(particles, &batches.p1[begin], &batches.p2[begin], &batches.rest_id[begin], rest_lengths,
+		                              batches.batch_begin[b + 1] - begin);
+	}
+}
+#endif
@@ -0,0 +1,223 @@
+#ifndef FIXED_FLAG_H
+#define FIXED_FLAG_H
+
+#include <Base/ParticleStore.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <array>
+
+/* A Flag whose grid size and number of constraint iterations are known at compile time, for the few resolutions used in production.
+The particles live in std::array (a 32x32 flag keeps its positions in L1), the loops have constant bounds the compiler can unroll,
+and the index arithmetic folds to constants. The constraints are the stencil of the Flag class, swept row after row like
+SolverMode::Stencil, with the same rest lengths and the same rounding of the corrections and of the integration, so both give the same positions.
+The particle (x,y) is at index y*W + x. The object holds all its particles, allocate the large ones on the heap.
+The rows of the stencil with a vertical offset have no dependency along x and vectorize.
+The runtime sized Flag remains the generic fallback.
+*/
+template<int W, int H, int Iterations = CONSTRAINT_ITERATIONS>
+class FixedFlag
+{
+	static_assert(W >= 3 && H >= 3, "the stencil needs at least 3 particles in each direction");
+	static constexpr int N = W * H; // total number of particles
+
+public:
+	FixedFlag(float width, float height)
+	{
+		const float cell_width = width / W;
+		const float cell_height = height / H;
+		for (int y = 0; y < H; y++)
+		{
+			for (int x = 0; x < W; x++)
+			{
+				const int i = y * W + x;
+				pos_x[i] = old_x[i] = width * (x / (float)W);
+				pos_y[i] = old_y[i] = height * (y / (float)H);
+				pos_z[i] = old_z[i] = 0;
+			}
+		}
+		acc_x.fill(0); acc_y.fill(0); acc_z.fill(0);
+		normal_x.fill(0); normal_y.fill(0); normal_z.fill(0);
+
+		// the rest length of each offset of the stencil, in the order used by satisfyStencil()
+		const int offsets[8][2] = {{1,0}, {0,1}, {1,1}, {-1,1}, {2,0}, {0,2}, {2,2}, {-2,2}};
+		for (int k = 0; k < 8; k++)
+		{
+			rest_distance[k] = Vec3(offsets[k][0] * cell_width, offsets[k][1] * cell_height, 0).length();
+		}
+
+		// the column x = 0 is pinned
+		movable.fill(1.0f);
+		for (int y = 0; y < H; y++)
+		{
+			movable[y * W] = 0.0f;
+		}
+	}
+
+	static constexpr int width() {return W;}
+	static constexpr int height() {return H;}
+
+	Vec3 getPos(int x, int y) const {const int i = y * W + x; return Vec3(pos_x[i], pos_y[i], pos_z[i]);}
+	Vec3 getNormal(int x, int y) const {const int i = y * W + x; return Vec3(normal_x[i], normal_y[i], normal_z[i]);} // unit length
+
+	/* used to add gravity (or any other arbitrary vector) to all particles */
+	void addForce(const Vec3 force)
+	{
+		for (int i = 0; i < N; i++) acc_x[i] += force.f[0] / MASS;
+		for (int i = 0; i < N; i++) acc_y[i] += force.f[1] / MASS;
+		for (int i = 0; i < N; i++) acc_z[i] += force.f[2] / MASS;
+	}
+
+	/* the wind force of each triangle is proportional to its area as seen from the wind direction, same triangles as Flag::addwindForce() */
+	void addwindForce(const Vec3 direction)
+	{
+		for (int y = 0; y < H - 1; y++)
+		{
+			for (int x = 0; x < W - 1; x++)
+			{
+				const int p1 = y * W + x, p2 = p1 + 1, p3 = p1 + W, p4 = p1 + W + 1;
+				Vec3 normal = triangleNormal(p2, p1, p3);
+				Vec3 force = normal * (normal.normalized().dot(direction));
+				addForce(p1, force);
+				addForce(p2, force);
+				addForce(p3, force);
+
+				normal = triangleNormal(p4, p2, p3);
+				force = normal * (normal.normalized().dot(direction));
+				addForce(p2, force);
+				addForce(p3, force);
+				addForce(p4, force);
+			}
+		}
+	}
+
+	/* Iterations sweeps over the stencil, then the verlet integration of every movable particle */
+	void timeStep()
+	{
+		for (int i = 0; i < Iterations; i++)
+		{
+			satisfyStencil();
+		}
+		integrate(pos_x, old_x, acc_x);
+		integrate(pos_y, old_y, acc_y);
+		integrate(pos_z, old_z, acc_z);
+	}
+
+	/* smooth per particle normals, same triangles as Flag::updateNormals(), normalized once summed */
+	void updateNormals()
+	{
+		normal_x.fill(0); normal_y.fill(0); normal_z.fill(0);
+		for (int y = 0; y < H - 1; y++)
+		{
+			for (int x = 0; x < W - 1; x++)
+			{
+				const int p1 = y * W + x, p2 = p1 + 1, p3 = p1 + W, p4 = p1 + W + 1;
+				Vec3 normal = triangleNormal(p2, p1, p3).normalized();
+				addToNormal(p4, normal);
+				addToNormal(p2, normal);
+				addToNormal(p1, normal);
+
+				normal = triangleNormal(p4, p2, p3).normalized();
+				addToNormal(p4, normal);
+				addToNormal(p1, normal);
+				addToNormal(p3, normal);
+			}
+		}
+		for (int i = 0; i < N; i++)
+		{
+			const float length = sqrtf(normal_x[i]*normal_x[i] + normal_y[i]*normal_y[i] + normal_z[i]*normal_z[i]);
+			normal_x[i] /= length;
+			normal_y[i] /= length;
+			normal_z[i] /= length;
+		}
+	}
+
+private:
+	std::array<float, N> pos_x, pos_y, pos_z;
+	std::array<float, N> old_x, old_y, old_z;
+	std::array<float, N> acc_x, acc_y, acc_z;
+	std::array<float, N> normal_x, normal_y, normal_z;
+	std::array<float, N> movable; // 1 when the particle can move, 0 when it is pinned, so the solver needs no branch
+	float rest_distance[8];
+
+	Vec3 triangleNormal(int p1, int p2, int p3) const
+	{
+		Vec3 pos1(pos_x[p1], pos_y[p1], pos_z[p1]);
+		Vec3 v1 = Vec3(pos_x[p2], pos_y[p2], pos_z[p2]) - pos1;
+		Vec3 v2 = Vec3(pos_x[p3], pos_y[p3], pos_z[p3]) - pos1;
+		return v1.cross(v2);
+	}
+
+	void addForce(int i, Vec3 force)
+	{
+		acc_x[i] += force.f[0] / MASS;
+		acc_y[i] += force.f[1] / MASS;
+		acc_z[i] += force.f[2] / MASS;
+	}
+
+	void addToNormal(int i, Vec3 normal)
+	{
+		normal_x[i] += normal.f[0];
+		normal_y[i] += normal.f[1];
+		normal_z[i] += normal.f[2];
+	}
+
+	void satisfyStencil()
+	{
+		for (int y = 0; y < H; y++)
+		{
+			satisfyRow<1, 0>(y, rest_distance[0]);
+			satisfyRow<0, 1>(y, rest_distance[1]);
+			satisfyRow<1, 1>(y, rest_distance[2]);
+			satisfyRow<-1, 1>(y, rest_distance[3]);
+			satisfyRow<2, 0>(y, rest_distance[4]);
+			satisfyRow<0, 2>(y, rest_distance[5]);
+			satisfyRow<2, 2>(y, rest_distance[6]);
+			satisfyRow<-2, 2>(y, rest_distance[7]);
+		}
+	}
+
+	/* the constraints between (x,y) and (x+DX,y+DY) along the row y. When DY > 0 two consecutive constraints of the row
+	share no particle, the compiler vectorizes the loop across x; only the horizontal offsets chain from one x to the next */
+	template<int DX, int DY>
+	void satisfyRow(int y, float rest)
+	{
+		if (y + DY >= H)
+			return;
+		constexpr int x_begin = DX < 0 ? -DX : 0;
+		constexpr int x_end = DX > 0 ? W - DX : W;
+		const int row = y * W;
+		for (int x = x_begin; x < x_end; x++)
+		{
+			satisfy(row + x, row + DY * W + x + DX, rest);
+		}
+	}
+
+	/* same correction as Constraint::satisfyConstraint(), pinned particles are scaled by a zero weight */
+	void satisfy(int p1, int p2, float rest)
+	{
+		const float dx = pos_x[p2] - pos_x[p1], dy = pos_y[p2] - pos_y[p1], dz = pos_z[p2] - pos_z[p1];
+		const float violation = 1 - rest / sqrtf(dx*dx + dy*dy + dz*dz);
+		const float cx = dx * violation * 0.5f, cy = dy * violation * 0.5f, cz = dz * violation * 0.5f; // rounded as p1_to_p2*violation*0.5
+		pos_x[p1] += cx * movable[p1];
+		pos_y[p1] += cy * movable[p1];
+		pos_z[p1] += cz * movable[p1];
+		pos_x[p2] -= cx * movable[p2];
+		pos_y[p2] -= cy * movable[p2];
+		pos_z[p2] -= cz * movable[p2];
+	}
+
+	void integrate(std::array<float, N> &pos, std::array<float, N> &old, std::array<float, N> &acc)
+	{
+		const float damping = 1.0f - (float)DAMPING; // the same rounding as ParticleStore::integrate()
+		for (int i = 0; i < N; i++)
+		{
+			const float temp = pos[i];
+			const float next = pos[i] + (pos[i] - old[i]) * damping + acc[i] * (float)TIME_STEPSIZE2;
+			pos[i] = movable[i] != 0.0f ? next : temp;
+			old[i] = movable[i] != 0.0f ? temp : old[i];
+			acc[i] = 0;
+		}
+	}
+};
+#endif
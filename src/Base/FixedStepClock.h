@@ -0,0 +1,50 @@
+#ifndef FIXED_STEP_CLOCK_H
+#define FIXED_STEP_CLOCK_H
+
+#include <math.h>
+#include <algorithm>
+
+#define SIMULATION_RATE 60 // time steps of the Flag per second of real time, whatever the refresh rate of the display
+#define MAX_STEPS_PER_FRAME 4 // a slower frame drops the time beyond this many steps instead of falling further behind
+
+/* Decouples the time steps of the simulation from the frames of the display: the real time elapsed between two frames
+is accumulated and spent in time steps of fixed length, so a frame runs zero, one or several time steps.
+The time left in the accumulator, less than one step, is how far the display is between the last two states of the simulation,
+render() interpolates the particles by this fraction so the motion stays smooth at any refresh rate.
+*/
+class FixedStepClock
+{
+public:
+	FixedStepClock(float step = 1.0f / SIMULATION_RATE, int max_steps = MAX_STEPS_PER_FRAME) : step(step), max_steps(max_steps) {}
+
+	/* adds the real time elapsed since the previous frame, returns how many time steps this frame must run */
+	int advance(float elapsed)
+	{
+		accumulator += std::max((double)elapsed, 0.0);
+		const int steps = std::min((int)(accumulator / step), max_steps);
+		accumulator -= steps * step;
+		if (accumulator >= step)
+		{
+			// the delay beyond max_steps is forgotten, only the fraction of a step is kept for the interpolation
+			dropped += (int)(accumulator / step);
+			accumulator = fmod(accumulator, (double)step);
+		}
+		last_steps = steps;
+		return steps;
+	}
+
+	/* how far the display is from the previous state of the simulation (0) to the last one (1) */
+	float alpha() const {return std::min((float)(accumulator / step), 1.0f);}
+
+	float stepLength() const {return step;}
+	int lastSteps() const {return last_steps;} // the time steps the last frame ran
+	int droppedSteps() const {return dropped;} // the time steps dropped since the start to keep up with the display
+
+private:
+	float step; // the length of a time step in seconds
+	int max_steps;
+	double accumulator = 0.0; // the real time not yet simulated, in double so that thousands of frames do not drift
+	int last_steps = 0;
+	int dropped = 0;
+};
+#endif
@@ -1,399 +1,1145 @@
+#ifndef FLAG_CPP
+#define FLAG_CPP
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 #include <glm/glm.hpp>
 
+#include <Base/ParticleStore.h>
+#include <Base/ConstraintKernel.h>
+#include <Base/JacobiSolver.h>
+#include <Base/StencilSolver.h>
+#include <Base/GridLayout.h>
+#include <Base/XpbdSolver.h>
+#include <Base/MultigridSolver.h>
+#include <Base/ChebyshevAccelerator.h>
+#include <Base/SleepTracker.h>
+#include <Base/FlagSnapshot.h>
+#include <Base/TaskGraph.h>
+#include <Base/ForceFields.h>
+#include <Base/TriangleCache.h>
+#include <Base/VertexRing.h>
+#include <Base/VertexFormat.h>
+
 #include <math.h>
+#include <memory>
+#include <thread>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 
+#define FRAME_BAND_ROWS 16 // the rows of a band of the tasks of Flag::simulateFrame(), at least STENCIL_REACH
+
 
-/* Some physics constants */
-#define DAMPING 0.01 // how much to damp the Flag simulation each frame
-#define TIME_STEPSIZE2 1 // how large time step each particle takes each frame
-#define CONSTRAINT_ITERATIONS 15 // how many iterations of constraint satisfaction each frame (more is rigid, less is soft)
-#define MASS 1 // mass of one particle
+/* How Flag::timeStep() walks through the constraints */
+enum class SolverMode
+{
+	Sequential, // one constraint after the other, in creation order
+	Batched, // batches of independent constraints solved by the vectorized kernel of ConstraintKernel.h
+	Colored, // colors of independent constraints solved in parallel by the threads of the Flag, one color after the other
+	Jacobi, // every particle averages the corrections of its constraints computed from the previous positions, in parallel (slower convergence)
+	Stencil, // the constraints are generated from the grid coordinates while sweeping the rows, no constraint is stored
+	Blocked, // the Stencil sweeps with temporal blocking: all the iterations run on a strip of the grid kept in cache
+	Multigrid, // the Stencil sweeps preceded by sweeps of coarser grids, whose constraints between neighbor coarse particles only resist stretching: the sag crosses a large flag in a few sweeps
+	Xpbd // substeps of extended position based dynamics, the stiffness comes from the compliance of the constraints
+};
 
-class Vec3
-{	
+/* The families of constraints of the grid, each one gets its own colors */
+enum Constraint_Family {
+	STRETCH, // immediate horizontal and vertical neighbors
+	SHEAR, // immediate diagonal neighbors
+	SECONDARY, // neighbors at distance 2
+	NUM_CONSTRAINT_FAMILIES
+};
+
+/* A constraint only holds the indices of its two particles and the id of its rest length in the table of the Flag, 9 bytes in all.
+Since no pointer is kept, the particles can be reordered, resized or relocated freely */
+#pragma pack(push, 1)
+class Constraint
+{
 public:
-	float f[3];
+	uint32_t p1, p2; // the indices in the particle store of the two particles that are connected through this constraint
+	uint8_t rest_id; // the id in the rest length table of the length between particle p1 and p2 in rest configuration
 
-	Vec3(float x, float y, float z)
+	Constraint(uint32_t p1, uint32_t p2, uint8_t rest_id) : p1(p1), p2(p2), rest_id(rest_id) {}
+
+	/* the particle of the constraint first in memory, by value: the members of the packed class cannot be bound to references (std::min) */
+	uint32_t firstParticle() const {return p1 < p2 ? p1 : p2;}
+
+	/* This is one of the important methods, where a single constraint between two particles p1 and p2 is solved
+	the spring model is very simplified we don't take into account elasticity value or fluid friction(air).
+	Returns the relative violation of the constraint before the correction */
+	float satisfyConstraint(ParticleStore &particles, const RestLengthTable &rest_lengths)
 	{
-		f[0] =x;
-		f[1] =y;
-		f[2] =z;
+		float rest_distance = rest_lengths[rest_id];
+		Vec3 p1_to_p2 = particles.getPos(p2)-particles.getPos(p1); // vector from p1 to p2
+		float current_distance = p1_to_p2.length(); // current distance between p1 and p2
+		float violation = 1 - rest_distance/current_distance;
+		Vec3 correctionVector = p1_to_p2*violation; // The offset vector that could moves p1 into a distance of rest_distance to p2
+		Vec3 correctionVectorHalf = correctionVector*0.5; // Lets make it half that length, so that we can move BOTH p1 and p2.
+		particles.offsetPos(p1, correctionVectorHalf); // correctionVectorHalf is pointing from p1 to p2, so the length should move p1 half the length needed to satisfy the constraint.
+		particles.offsetPos(p2, -correctionVectorHalf); // we must move p2 the negative direction of correctionVectorHalf since it points from p2 to p1, and not p1 to p2.	
+		return fabsf(violation);
 	}
+};
+#pragma pack(pop)
+static_assert(sizeof(Constraint) == 9, "a constraint is two 32 bits indices and a 8 bits rest length id");
+
+class Flag
+{
+private:
 
-	Vec3() {}
+	int num_particles_width; 
+	int num_particles_height; 
+	// total number of particles is num_particles_width*num_particles_height
 
-	float length()
+	ParticleStore particles; // all particles that are part of this Flag
+	GridLayout layout; // where the particle of each cell of the grid is stored
+	std::vector<Constraint> constraints; // alle constraints between particles as part of this Flag
+	RestLengthTable rest_lengths; // the distinct rest lengths of the constraints
+	float cell_width, cell_height; // the distance between two neighbor particles at rest
+	ConstraintBatches constraint_batches; // the same constraints regrouped for the vectorized kernel
+	ConstraintColors constraint_colors; // the same constraints split in colors for the parallel solver
+	JacobiSolver jacobi_solver; // the same constraints seen from each particle, with double-buffered positions
+	XpbdSolver xpbd_solver; // the same constraints with their compliance and Lagrange multiplier
+	MultigridSolver multigrid_solver; // the coarse grids of the Multigrid mode
+	ChebyshevAccelerator chebyshev; // extrapolates the iterations of the Sequential, Batched, Stencil and Multigrid modes
+	bool chebyshev_enabled = false;
+	SleepTracker sleep_tracker; // the tiles of particles at rest, skipped by the time steps
+	bool sleeping_enabled = false;
+	Vec3 last_force = Vec3(0,0,0), last_wind = Vec3(0,0,0); // the forces of the previous time step, a change wakes every tile
+	float tolerance = 0.0f; // the root mean square of the relative violations of the constraints that ends the iterations early, 0 always runs max_iterations
+	float min_decrease = 0.0f; // the iterations also end when one of them decreases the violation by less than this fraction
+	int max_iterations = CONSTRAINT_ITERATIONS;
+	int iterations = CONSTRAINT_ITERATIONS; // how many iterations the last time step ran
+	SubstepScheduler substep_scheduler; // how the Xpbd mode splits a frame
+	float compliance[NUM_CONSTRAINT_FAMILIES] = {}; // the compliance of each family of constraints in the Xpbd mode, 0 is rigid
+	std::vector<float> previous_x, previous_y, previous_z; // the positions before the last time step, for the interpolation of render(), empty when disabled
+	bool interpolation_enabled = false;
+	unsigned step_count = 0; // the time steps run so far
+	unsigned normals_step = ~0u; // step_count when the normals were last computed, render() only recomputes them after a time step
+	TaskGraph frame_graph; // the phases of simulateFrame() as tasks on bands of FRAME_BAND_ROWS rows, built by the first pipelined frame
+	bool pipelined = false;
+	Vec3 frame_gravity = Vec3(0,0,0), frame_wind = Vec3(0,0,0); // the forces of the frame frame_graph runs
+	TriangleCache triangles; // the normals of the triangles at the current positions, shared by updateNormals() and the next addwindForce()
+	SolverMode solver_mode = SolverMode::Colored;
+	std::unique_ptr<ThreadPool> thread_pool; // the threads solving the colors, the thread calling timeStep() included
+
+	int getParticle(int x, int y) {return layout.index(x,y);}
+	void makeConstraint(int x1, int y1, int x2, int y2)
 	{
-		return sqrt(f[0]*f[0]+f[1]*f[1]+f[2]*f[2]);
+		float rest_distance = Vec3((x2-x1)*cell_width, (y2-y1)*cell_height, 0).length();
+		constraints.push_back(Constraint(getParticle(x1,y1), getParticle(x2,y2), rest_lengths.add(rest_distance)));
 	}
 
-	Vec3 normalized()
+	Constraint_Family getFamily(const Constraint &constraint)
 	{
-		float l = length();
-		return Vec3(f[0]/l,f[1]/l,f[2]/l);
+		int dx = abs(layout.x(constraint.p1) - layout.x(constraint.p2));
+		int dy = abs(layout.y(constraint.p1) - layout.y(constraint.p2));
+		if (dx + dy == 1) return STRETCH;
+		if (dx == 1 && dy == 1) return SHEAR;
+		return SECONDARY;
 	}
 
-	void operator+= (const Vec3 &v)
+	/* A private method used for flag rendering to retrieve the  
+	normal vector of the triangle defined by the position of the particles p1, p2, and p3.
+	The magnitude of the normal vector = the area of the parallelogram (P1P2,P1P3)
+	*/
+	Vec3 calcTriangleNormal(int p1,int p2,int p3)
 	{
-		f[0]+=v.f[0];
-		f[1]+=v.f[1];
-		f[2]+=v.f[2];
+		Vec3 pos1 = particles.getPos(p1);
+		Vec3 pos2 = particles.getPos(p2);
+		Vec3 pos3 = particles.getPos(p3);
+
+		Vec3 v1 = pos2-pos1;
+		Vec3 v2 = pos3-pos1;
+
+ 		return v1.cross(v2);
 	}
 
-	Vec3 operator/ (const float &a)
+	/* the triangle cache, computed from the current positions if a time step moved them since it was last filled, each thread building its own rows */
+	const TriangleCache& triangleCache()
 	{
-		return Vec3(f[0]/a,f[1]/a,f[2]/a);
+		if (!triangles.isValid())
+		{
+			const int num_threads = thread_pool->size();
+			thread_pool->run([&](int t)
+			{
+				triangles.buildRows(particles, layout, num_particles_height * t / num_threads, num_particles_height * (t+1) / num_threads);
+			});
+			triangles.validate();
+		}
+		return triangles;
 	}
 
-	Vec3 operator- (const Vec3 &v)
+	/* the arrays the vertices are built from: the particles of the Flag, or a snapshot of them published by the simulation thread */
+	struct VertexSource
+	{
+		const float *pos_x, *pos_y, *pos_z;
+		const float *previous_x, *previous_y, *previous_z; // nullptr when there is nothing to interpolate from
+		const float *normal_x, *normal_y, *normal_z;
+		float alpha; // between the previous (0) and current (1) positions
+	};
+	VertexSource vertex_source;
+
+	void setVertexSource(float alpha)
 	{
-		return Vec3(f[0]-v.f[0],f[1]-v.f[1],f[2]-v.f[2]);
+		vertex_source = {particles.pos_x.data(), particles.pos_y.data(), particles.pos_z.data(),
+		                 nullptr, nullptr, nullptr,
+		                 particles.normal_x.data(), particles.normal_y.data(), particles.normal_z.data(), alpha};
+		if (!previous_x.empty())
+		{
+			vertex_source.previous_x = previous_x.data();
+			vertex_source.previous_y = previous_y.data();
+			vertex_source.previous_z = previous_z.data();
+		}
+	}
+	void setVertexSource(const FlagSnapshot &snapshot, float alpha)
+	{
+		vertex_source = {snapshot.pos_x.data(), snapshot.pos_y.data(), snapshot.pos_z.data(),
+		                 snapshot.previous_x.data(), snapshot.previous_y.data(), snapshot.previous_z.data(),
+		                 snapshot.normal_x.data(), snapshot.normal_y.data(), snapshot.normal_z.data(), alpha};
 	}
 
-	Vec3 operator+ (const Vec3 &v)
+	/* the position drawn for the particle p, between its previous and current positions */
+	void sourcePosition(int p, float &x, float &y, float &z)
 	{
-		return Vec3(f[0]+v.f[0],f[1]+v.f[1],f[2]+v.f[2]);
+		const VertexSource &source = vertex_source;
+		if (source.alpha < 1.0f && source.previous_x)
+		{
+			x = source.previous_x[p] + (source.pos_x[p] - source.previous_x[p]) * source.alpha;
+			y = source.previous_y[p] + (source.pos_y[p] - source.previous_y[p]) * source.alpha;
+			z = source.previous_z[p] + (source.pos_z[p] - source.previous_z[p]) * source.alpha;
+		}
+		else
+		{
+			x = source.pos_x[p];
+			y = source.pos_y[p];
+			z = source.pos_z[p];
+		}
 	}
 
-	Vec3 operator* (const float &a)
+	void AddVertex(int p, float *&vertex)
 	{
-		return Vec3(f[0]*a,f[1]*a,f[2]*a);
+		const VertexSource &source = vertex_source;
+		Vec3 normal = Vec3(source.normal_x[p], source.normal_y[p], source.normal_z[p]); // of unit length, see updateNormals()
+
+		sourcePosition(p, vertex[0], vertex[1], vertex[2]);
+		vertex[3] = normal.f[0];
+		vertex[4] = normal.f[1];
+		vertex[5] = normal.f[2];
+		vertex += 6;
 	}
 
-	Vec3 operator-()
+	/* the vertex of every particle written to vertex in the format of vertex_packer, in the order of vertexIndex(): the triangles index them (see buildIndices()) */
+	void addVertices(unsigned char *vertex)
 	{
-		return Vec3(-f[0],-f[1],-f[2]);
+		if (vertex_packer.format == VertexFormat::Position)
+		{
+			// the positions only, in row major order for the vertex shader
+			float *floats = (float*)vertex;
+			for(int y = 0; y<num_particles_height; y++)
+			{
+				for(int x = 0; x<num_particles_width; x++, floats += 3)
+					sourcePosition(layout.index(x,y), floats[0], floats[1], floats[2]);
+			}
+			return;
+		}
+		if (vertex_packer.format == VertexFormat::Float)
+		{
+			float *floats = (float*)vertex;
+			for(int i = 0; i<particles.size(); i++)
+				AddVertex(i, floats);
+			return;
+		}
+		const VertexSource &source = vertex_source;
+		for(int i = 0; i<particles.size(); i++)
+		{
+			float x, y, z;
+			sourcePosition(i, x, y, z);
+			vertex_packer.store(x, y, z, source.normal_x[i], source.normal_y[i], source.normal_z[i], vertex);
+		}
 	}
 
-	Vec3 cross(const Vec3 &v)
+	/* fits the Quantized format to the positions of vertex_source, the interpolated ones lie between the previous and current positions */
+	void fitVertexSource()
 	{
-		return Vec3(f[1]*v.f[2] - f[2]*v.f[1], f[2]*v.f[0] - f[0]*v.f[2], f[0]*v.f[1] - f[1]*v.f[0]);
+		const VertexSource &source = vertex_source;
+		float minimum[3] = {INFINITY, INFINITY, INFINITY}, maximum[3] = {-INFINITY, -INFINITY, -INFINITY};
+		const float *arrays[2][3] = {{source.pos_x, source.pos_y, source.pos_z}, {source.previous_x, source.previous_y, source.previous_z}};
+		for (int a = 0; a < (source.alpha < 1.0f && source.previous_x ? 2 : 1); a++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				for (int i = 0; i < particles.size(); i++)
+				{
+					minimum[c] = std::min(minimum[c], arrays[a][c][i]);
+					maximum[c] = std::max(maximum[c], arrays[a][c][i]);
+				}
+			}
+		}
+		vertex_packer.fit(minimum, maximum);
 	}
 
-	float dot(const Vec3 &v)
+	/* writes the vertices of vertex_source in vertex_format, or their positions with the shader normals, to the vertex ring and draws them */
+	void drawVertexSource()
 	{
-		return f[0]*v.f[0] + f[1]*v.f[1] + f[2]*v.f[2];
+		const VertexFormat format = shader_normals ? VertexFormat::Position : vertex_format;
+		vertex_packer = VertexPacker(format);
+		if (format == VertexFormat::Quantized)
+			fitVertexSource();
+		addVertices(vertex_ring.map(particles.size(), format));
+		vertex_ring.draw(flag_indices, indices_version, vertex_packer, num_particles_width, num_particles_height);
 	}
 
-};
+	/* addVertices() for the particles of the rows y_first <= y < y_last, in row major order, at their place in flag_vertices which is already sized */
+	void addVerticesRows(int y_first, int y_last)
+	{
+		float *vertex = flag_vertices.data() + (size_t)y_first * num_particles_width * 6;
+		for(int i = y_first * num_particles_width; i < y_last * num_particles_width; i++)
+			AddVertex(i, vertex);
+	}
 
-/* The particle class represents a particle of mass that can move around in 3D space*/
-class Particle
-{
-private:
-	bool movable; // can the particle move or not ? used to pin parts of the Flag
+	/* the vertex of the particle (x,y) in the vertex buffer: the particle itself, or its place in the row major grid read by the vertex shader with the shader normals */
+	int vertexIndex(int x, int y) {return shader_normals ? y*num_particles_width + x : getParticle(x,y);}
+
+	/* the two triangles of every quad, in the layout order, as indices of their vertices. They only change with the grid, the layout and the shader normals */
+	void buildIndices()
+	{
+		flag_indices.clear();
+		flag_indices.reserve((size_t)(num_particles_width-1) * (num_particles_height-1) * 6);
+		for(int i = 0; i<particles.size(); i++)
+		{
+			int x = layout.x(i), y = layout.y(i);
+			if (x>=num_particles_width-1 || y>=num_particles_height-1)
+				continue;
 
-	float mass; // the mass of the particle (is always 1 in this example)
-	Vec3 old_pos; // the position of the particle in the previous time step, used as part of the verlet numerical integration scheme
-	Vec3 acceleration; // a vector representing the current acceleration of the particle
-	Vec3 accumulated_normal; // an accumulated normal (i.e. non normalized), used for OpenGL soft shading
+			const GLuint quad[6] = {(GLuint)vertexIndex(x,y), (GLuint)vertexIndex(x,y+1), (GLuint)vertexIndex(x+1,y+1),
+			                        (GLuint)vertexIndex(x,y), (GLuint)vertexIndex(x+1,y), (GLuint)vertexIndex(x+1,y+1)};
+			flag_indices.insert(flag_indices.end(), quad, quad + 6);
+		}
+		indices_version++;
+	}
 
-public:
-	Vec3 pos; // the current position of the particle in 3D space
+	/* the list of constraints and the structures derived from it are only built for the solver modes that need them,
+	the Stencil, Blocked and Multigrid modes never allocate them */
+	void buildConstraints()
+	{
+		// the constraints of each particle are created in the layout order
+		for(int i=0; i<particles.size(); i++)
+		{
+			int x = layout.x(i), y = layout.y(i);
+
+			// Connecting immediate neighbor particles with constraints (distance 1 and sqrt(2) in the grid)
+			if (x<num_particles_width-1) makeConstraint(x,y,x+1,y);
+			if (y<num_particles_height-1) makeConstraint(x,y,x,y+1);
+			if (x<num_particles_width-1 && y<num_particles_height-1) makeConstraint(x,y,x+1,y+1);
+			if (x<num_particles_width-1 && y<num_particles_height-1) makeConstraint(x+1,y,x,y+1);
+
+			// Connecting secondary neighbors with constraints (distance 2 and sqrt(4) in the grid)
+			if (x<num_particles_width-2) makeConstraint(x,y,x+2,y);
+			if (y<num_particles_height-2) makeConstraint(x,y,x,y+2);
+			if (x<num_particles_width-2 && y<num_particles_height-2) makeConstraint(x,y,x+2,y+2);
+			if (x<num_particles_width-2 && y<num_particles_height-2) makeConstraint(x+2,y,x,y+2);
+		}
 
-	Particle(Vec3 pos,float mass) : pos(pos), old_pos(pos),acceleration(Vec3(0,0,0)), mass(MASS), movable(true), accumulated_normal(Vec3(0,0,0)){}
-	Particle(){}
+		// sorted by their first particle in memory, consecutive constraints touch neighbor particles
+		std::stable_sort(constraints.begin(), constraints.end(), [](const Constraint &a, const Constraint &b)
+		{
+			return a.firstParticle() < b.firstParticle();
+		});
+	}
 
-	void addForce(Vec3 f)
+	/* the constraints must be rebuilt when the particles move in memory */
+	void clearConstraints()
 	{
-		acceleration += f/mass;
+		constraints.clear();
+		rest_lengths = RestLengthTable();
+		constraint_batches = ConstraintBatches();
+		constraint_colors = ConstraintColors();
+		jacobi_solver = JacobiSolver();
+		xpbd_solver = XpbdSolver();
+		multigrid_solver = MultigridSolver();
+		sleep_tracker = SleepTracker();
 	}
 
-	void timeStep()
+	/* the early exit of the iterations, see setTolerance() */
+	bool isConverged(float violation, float previous_violation) const
+	{
+		return violation < tolerance || (min_decrease > 0.0f && previous_violation - violation < min_decrease * previous_violation);
+	}
+
+	void prepareSolver()
 	{
-		if(movable)
+		if (sleeping_enabled && !sleep_tracker.isBuilt())
+			sleep_tracker.build(layout, num_particles_width, num_particles_height, std::min(cell_width, cell_height));
+		if (solver_mode == SolverMode::Multigrid && !multigrid_solver.isBuilt())
+			multigrid_solver.build(particles, layout, num_particles_width, num_particles_height, cell_width, cell_height);
+		if (solver_mode == SolverMode::Stencil || solver_mode == SolverMode::Blocked || solver_mode == SolverMode::Multigrid)
+			return;
+		if (constraints.empty())
+			buildConstraints();
+		if (solver_mode == SolverMode::Batched && constraint_batches.numBatches() < 0)
+			constraint_batches.build(constraints, particles.size());
+		if (solver_mode == SolverMode::Colored && constraint_colors.numColors() < 0)
+			constraint_colors.build(constraints, particles.size(), NUM_CONSTRAINT_FAMILIES,
+			                        [this](int c) {return getFamily(constraints[c]);});
+		if (solver_mode == SolverMode::Jacobi && !jacobi_solver.isBuilt())
+			jacobi_solver.build(constraints, particles.size());
+		if (solver_mode == SolverMode::Xpbd && !xpbd_solver.isBuilt())
+			xpbd_solver.build(constraints, [this](int c) {return compliance[getFamily(constraints[c])];});
+	}
+
+    VertexRing vertex_ring; // the OpenGL buffers, created by the first render()
+    VertexFormat vertex_format = VertexFormat::Float; // of the vertex buffer
+    VertexPacker vertex_packer; // how addVertices() writes, the floats of flag_vertices or vertex_format
+    bool shader_normals = false; // render() uploads the positions only, the vertex shader derives the normals
+    std::vector<float> flag_vertices; // the vertices built without drawing them, by buildVertices() and simulateFrame()
+    std::vector<GLuint> flag_indices;
+    unsigned indices_version = 0; // changes with flag_indices
+public:
+
+	/* This is a important constructor for the entire system of particles and constraints,
+	num_threads is the size of the thread pool of the Colored and Jacobi solvers and of the pipelined frames, see setNumThreads() */
+	Flag(float width, float height, int num_particles_width, int num_particles_height, int num_threads = (int)std::thread::hardware_concurrency()) : num_particles_width(num_particles_width), num_particles_height(num_particles_height),
+		layout(num_particles_width, num_particles_height)
+	{
+		particles.resize(num_particles_width*num_particles_height);
+		cell_width = width/num_particles_width;
+		cell_height = height/num_particles_height;
+
+		for(int y=0; y<num_particles_height; y++)
 		{
-			Vec3 temp = pos;
-			pos = pos + (pos-old_pos) * (1.0 - DAMPING) + acceleration*TIME_STEPSIZE2;
-			old_pos = temp;
-			acceleration = Vec3(0,0,0); // acceleration is reset since it HAS been translated into a change in position (and implicitely into velocity)	
+			for(int x=0; x<num_particles_width; x++)
+			{
+				Vec3 pos = Vec3(width * (x/(float)num_particles_width),
+								height * (y/(float)num_particles_height),
+								0);
+				particles.init(getParticle(x,y), pos); // insert particle in column x at y'th row
+			}
 		}
+
+        for(int j=0;j<num_particles_height; j++) // the whole column x = 0, the flag of any size hangs from its pole
+        {
+            particles.makeUnmovable(getParticle(0 ,j)); 
+        }
+
+		triangles.resize(num_particles_width, num_particles_height);
+		buildIndices();
+		setNumThreads(num_threads);
 	}
 
-	Vec3& getPos() {return pos;}
+	/* moves the particles to the given memory order, the constraints are rebuilt for the new indices at the next time step */
+	void setParticleLayout(ParticleLayout type)
+	{
+		GridLayout next(num_particles_width, num_particles_height, type);
+		std::vector<uint32_t> destination(particles.size());
+		for(int y=0; y<num_particles_height; y++)
+		{
+			for(int x=0; x<num_particles_width; x++)
+			{
+				destination[layout.index(x,y)] = next.index(x,y);
+			}
+		}
+		particles.permute(destination);
+		layout = next;
+		clearConstraints();
+		previous_x.clear(); previous_y.clear(); previous_z.clear(); // in the old order, render() draws the current positions until the next time step
+		triangles.invalidate();
+		buildIndices();
+	}
+	ParticleLayout getParticleLayout() const {return layout.type();}
 
-	void resetAcceleration() {acceleration = Vec3(0,0,0);}
+	void setSolverMode(SolverMode mode) {solver_mode = mode;}
+	SolverMode getSolverMode() const {return solver_mode;}
 
-	void offsetPos(const Vec3 v) { if(movable) pos += v;}
+	/* number of threads used by the Colored and Jacobi solvers */
+	void setNumThreads(int num_threads) {thread_pool.reset(new ThreadPool(std::max(num_threads, 1)));}
+	int getNumThreads() const {return thread_pool->size();}
+	int getNumColors() const {return constraint_colors.numColors();}
+	int getNumConstraints() const {return (int)constraints.size();}
+	int getNumLevels() const {return multigrid_solver.numLevels();} // the grids of the Multigrid mode, once built
 
-	void makeUnmovable() {movable = false;}
+	/* compliance (inverse stiffness) of the constraints of a family in the Xpbd mode, 0 is rigid */
+	void setCompliance(Constraint_Family family, float value)
+	{
+		compliance[family] = value;
+		xpbd_solver = XpbdSolver(); // rebuilt with the new compliance at the next time step
+	}
+	float getCompliance(Constraint_Family family) const {return compliance[family];}
 
-	void addToNormal(Vec3 normal)
+	/* the tiles of particles at rest fall asleep and are skipped by the forces, the normals and the Sequential, Stencil and Multigrid solvers */
+	void setSleeping(bool enabled)
 	{
-		accumulated_normal += normal.normalized();
+		if (!enabled && sleep_tracker.isBuilt())
+			sleep_tracker.wakeAll(particles);
+		sleeping_enabled = enabled;
 	}
+	int getNumSleepingTiles() const {return sleep_tracker.numSleeping();}
+	int getNumTiles() const {return sleep_tracker.numTiles();}
 
-	Vec3& getNormal() { return accumulated_normal;} // notice, the normal is not unit length
+	/* the Sequential, Stencil and Multigrid modes stop iterating once the root mean square of the relative violations of the constraints,
+	measured while sweeping them, is below tolerance, or once an iteration decreases it by less than min_decrease (a fraction of it):
+	the constraints of a folded flag conflict and the violation stalls well above 0. They stop after max_iterations otherwise, the other modes run CONSTRAINT_ITERATIONS iterations */
+	void setTolerance(float tolerance, int max_iterations = CONSTRAINT_ITERATIONS, float min_decrease = 0.0f)
+	{
+		this->tolerance = tolerance;
+		this->max_iterations = std::max(max_iterations, 1);
+		this->min_decrease = min_decrease;
+	}
+	int getIterations() const {return iterations;} // the number of iterations of the last time step
 
-	void resetNormal() {accumulated_normal = Vec3(0,0,0);}
-};
+	/* Chebyshev acceleration of the constraint iterations (Sequential, Batched, Stencil and Multigrid modes),
+	over_relaxation scales the corrections of each iteration */
+	void setChebyshev(bool enabled, float over_relaxation = 1.0f)
+	{
+		chebyshev_enabled = enabled;
+		chebyshev.over_relaxation = over_relaxation;
+	}
+	float getSpectralRadius() const {return chebyshev.spectralRadius();} // as estimated by the Chebyshev acceleration
 
-class Constraint
-{
-private:
-	float rest_distance; // the length between particle p1 and p2 in rest configuration
+	/* keeps the positions before each time step so that render() can draw the Flag between two time steps,
+	when the display runs faster than the simulation (see FixedStepClock) */
+	void setInterpolation(bool enabled)
+	{
+		interpolation_enabled = enabled;
+		if (!enabled)
+		{
+			previous_x.clear(); previous_y.clear(); previous_z.clear();
+		}
+	}
 
-public:
-	Particle *p1, *p2; // the two particles that are connected through this constraint
+	/* number of substeps of a frame and of constraint iterations per substep in the Xpbd mode */
+	void setSubsteps(int substeps, int iterations)
+	{
+		substep_scheduler.substeps = std::max(substeps, 1);
+		substep_scheduler.iterations = std::max(iterations, 1);
+	}
+
+	const ParticleStore& getParticles() const {return particles;}
 
-	Constraint(Particle *p1, Particle *p2) :  p1(p1),p2(p2)
+	/* create smooth per particle normals by adding up all the (hard) triangle normals that each particle is part of, normalized once,
+	the triangles are the ones drawn by render(). Each particle gathers the triangles of the triangle cache around it (see TriangleCache::gatherNormalsRows()),
+	the threads of the Flag split the rows and the normals are the same for any number of threads. The wind of the next time step reuses the cache */
+	void updateNormals()
 	{
-		Vec3 vec = p1->getPos()-p2->getPos();
-		rest_distance = vec.length();
+		normals_step = step_count;
+		if (sleeping_enabled && sleep_tracker.isBuilt() && sleep_tracker.numSleeping() > 0)
+		{
+			updateActiveNormals();
+			return;
+		}
+
+		triangleCache();
+		const int num_threads = thread_pool->size();
+		thread_pool->run([&](int t)
+		{
+			triangles.gatherNormalsRows(particles, layout, num_particles_height * t / num_threads, num_particles_height * (t+1) / num_threads);
+		});
 	}
 
-	/* This is one of the important methods, where a single constraint between two particles p1 and p2 is solved
-	the spring model is very simplified we don't take into account elasticity value or fluid friction(air) */
-	void satisfyConstraint()
+	/* updateNormals() in two parts for the rows y_first <= y < y_last, for the bands of rows of a FlagWorld: every band builds its triangles,
+	then every band gathers its normals once the triangles of its band and of the band above are built */
+	void buildTrianglesRows(int y_first, int y_last) {triangles.buildRows(particles, layout, y_first, y_last);}
+	void gatherNormalsRows(int y_first, int y_last) {triangles.gatherNormalsRows(particles, layout, y_first, y_last);}
+
+	/* fills flag_vertices with the position and the normal of every particle, render() writes them straight to the vertex buffer instead */
+	void buildVertices(float alpha = 1.0f)
 	{
-		Vec3 p1_to_p2 = p2->getPos()-p1->getPos(); // vector from p1 to p2
-		float current_distance = p1_to_p2.length(); // current distance between p1 and p2
-		Vec3 correctionVector = p1_to_p2*(1 - rest_distance/current_distance); // The offset vector that could moves p1 into a distance of rest_distance to p2
-		Vec3 correctionVectorHalf = correctionVector*0.5; // Lets make it half that length, so that we can move BOTH p1 and p2.
-		p1->offsetPos(correctionVectorHalf); // correctionVectorHalf is pointing from p1 to p2, so the length should move p1 half the length needed to satisfy the constraint.
-		p2->offsetPos(-correctionVectorHalf); // we must move p2 the negative direction of correctionVectorHalf since it points from p2 to p1, and not p1 to p2.	
+		setVertexSource(alpha);
+		flag_vertices.resize((size_t)particles.size() * 6);
+		vertex_packer = VertexPacker();
+		addVertices((unsigned char*)flag_vertices.data());
 	}
-};
 
-class Flag
-{
-private:
+	/* same as buildVertices() from a snapshot published by the simulation thread, the particles of the Flag are not read */
+	void buildVertices(const FlagSnapshot &snapshot, float alpha)
+	{
+		setVertexSource(snapshot, alpha);
+		flag_vertices.resize((size_t)particles.size() * 6);
+		vertex_packer = VertexPacker();
+		addVertices((unsigned char*)flag_vertices.data());
+	}
 
-	int num_particles_width; 
-	int num_particles_height; 
-	// total number of particles is num_particles_width*num_particles_height
+	/* computes the normals and copies what render() needs into snapshot, called by the simulation thread after its time steps.
+	The previous positions are the ones before the last time step when the interpolation is enabled, the current ones otherwise */
+	void writeSnapshot(FlagSnapshot &snapshot)
+	{
+		if (!shader_normals)
+			updateNormals();
+		snapshot.pos_x = particles.pos_x;
+		snapshot.pos_y = particles.pos_y;
+		snapshot.pos_z = particles.pos_z;
+		const bool interpolated = !previous_x.empty();
+		snapshot.previous_x = interpolated ? previous_x : particles.pos_x;
+		snapshot.previous_y = interpolated ? previous_y : particles.pos_y;
+		snapshot.previous_z = interpolated ? previous_z : particles.pos_z;
+		if (shader_normals)
+		{
+			// the vertex shader derives the normals, the arrays are only sized for buildVertices(snapshot)
+			snapshot.normal_x.resize(particles.size());
+			snapshot.normal_y.resize(particles.size());
+			snapshot.normal_z.resize(particles.size());
+			return;
+		}
+		snapshot.normal_x = particles.normal_x;
+		snapshot.normal_y = particles.normal_y;
+		snapshot.normal_z = particles.normal_z;
+	}
 
-	std::vector<Particle> particles; // all particles that are part of this Flag
-	std::vector<Constraint> constraints; // alle constraints between particles as part of this Flag
+	/* drawing the Flag as a smooth shaded (and colored according to column) OpenGL triangular mesh
+	Called from the display() method
+	The Flag is seen as consisting of triangles for four particles in the grid as follows:
 
-	Particle* getParticle(int x, int y) {return &particles[y*num_particles_width + x];}
-	void makeConstraint(Particle *p1, Particle *p2) {constraints.push_back(Constraint(p1,p2));}
+	(x+1,y) *--* (x+1,y+1)
+	        | /|
+	        |/ |
+	(x,y)   *--* (x,y+1)
 
-	/* A private method used for flag rendering to retrieve the  
-	normal vector of the triangle defined by the position of the particles p1, p2, and p3.
-	The magnitude of the normal vector = the area of the parallelogram (P1P2,P1P3)
+	Each particle is written once, straight into the mapped vertex buffer (see VertexRing.h), the triangles index the particles from a static element buffer.
+	alpha places the particles between their positions before (0) and after (1) the last time step, when the interpolation is enabled.
+	The normals are the ones of the last time step, computed by the first render() after it: the frames drawn between two time steps reuse them.
 	*/
-	Vec3 calcTriangleNormal(Particle *p1,Particle *p2,Particle *p3)
+	void render(float alpha = 1.0f)
 	{
-		Vec3 pos1 = p1->getPos();
-		Vec3 pos2 = p2->getPos();
-		Vec3 pos3 = p3->getPos();
+		if (!shader_normals && normals_step != step_count)
+			updateNormals();
+		setVertexSource(alpha);
+		drawVertexSource(); // written in the mapped vertex buffer
+	}
 
-		Vec3 v1 = pos2-pos1;
-		Vec3 v2 = pos3-pos1;
+	/* draws a snapshot published by the simulation thread while the thread keeps stepping the Flag,
+	only the grid size and the layout of the Flag are read, they must not change while the thread runs */
+	void render(const FlagSnapshot &snapshot, float alpha = 1.0f)
+	{
+		if (snapshot.pos_x.size() != (size_t)particles.size())
+			return; // nothing published yet
+		setVertexSource(snapshot, alpha);
+		drawVertexSource();
+	}
 
- 		return v1.cross(v2);
+	/* the layout of the vertices uploaded by render() and draw(), see VertexFormat.h: Half and Quantized take 12 bytes per vertex instead of 24 */
+	void setVertexFormat(VertexFormat format) {vertex_format = format;}
+	VertexFormat getVertexFormat() const {return vertex_format;}
+
+	/* render() and draw() upload the positions only, 12 bytes per vertex, in a buffer also read as a texture buffer by the vertex shader,
+	which derives the normal of each vertex from its neighbours in the grid (see shader.vs.glsl), and render() and writeSnapshot() skip updateNormals().
+	Set before the simulation thread starts */
+	void setShaderNormals(bool enabled)
+	{
+		shader_normals = enabled;
+		buildIndices(); // of the row major vertices
 	}
+	bool getShaderNormals() const {return shader_normals;}
 
-	void AddTriangle(Particle *p1, Particle *p2, Particle *p3)
+	/* deletes the OpenGL objects of render(), before the OpenGL context is destroyed */
+	void releaseBuffers() {vertex_ring.release();}
+
+	/* this is an important methods where the time is progressed one time step for the entire Flag.
+	This includes calling satisfyConstraint() for every constraint, and integrating every particle of the store
+	*/
+	void timeStep()
 	{
-        flag_vertices.push_back(p1->getPos().f[0]);
-        flag_vertices.push_back(p1->getPos().f[1]);
-        flag_vertices.push_back(p1->getPos().f[2]);
-        
-        flag_vertices.push_back(p1->getNormal().normalized().f[0]);
-        flag_vertices.push_back(p1->getNormal().normalized().f[1]);
-        flag_vertices.push_back(p1->getNormal().normalized().f[2]);
+		timeStep(ForcePipeline<>());
+	}
 
-        flag_vertices.push_back(p2->getPos().f[0]);
-        flag_vertices.push_back(p2->getPos().f[1]);
-        flag_vertices.push_back(p2->getPos().f[2]);
+	/* timeStep() with the force fields of a ForcePipeline (see ForceFields.h) applied by the integration itself, in the same pass:
+	flag.timeStep(makeForcePipeline(GravityField(g), DragField(k))) replaces the sweep of addForce(g) over the particles.
+	The fields do not wake the sleeping tiles */
+	template<typename Fields>
+	void timeStep(const Fields &fields)
+	{
+		if (interpolation_enabled)
+		{
+			previous_x = particles.pos_x;
+			previous_y = particles.pos_y;
+			previous_z = particles.pos_z;
+		}
+		prepareSolver();
+		solveAndIntegrate(fields);
+		triangles.invalidate();
+		step_count++;
+		if (sleeping_enabled)
+			sleep_tracker.update(particles);
+	}
 
-        flag_vertices.push_back(p2->getNormal().normalized().f[0]);
-        flag_vertices.push_back(p2->getNormal().normalized().f[1]);
-        flag_vertices.push_back(p2->getNormal().normalized().f[2]);
+	/* the pipelined frames run the phases of simulateFrame() as a graph of tasks on bands of rows (see buildFrameGraph()),
+	when solvesInBands(). The other frames run the phases one after the other */
+	void setPipelined(bool enabled) {pipelined = enabled;}
 
-        flag_vertices.push_back(p3->getPos().f[0]);
-        flag_vertices.push_back(p3->getPos().f[1]);
-        flag_vertices.push_back(p3->getPos().f[2]);
+	/* the time step can be solved in bands of rows: the Stencil mode with the row major layout, without sleeping, Chebyshev acceleration or tolerance */
+	bool solvesInBands() const
+	{
+		return solver_mode == SolverMode::Stencil && layout.type() == ParticleLayout::RowMajor
+		       && !sleeping_enabled && !chebyshev_enabled && tolerance <= 0.0f;
+	}
 
-        flag_vertices.push_back(p3->getNormal().normalized().f[0]);
-        flag_vertices.push_back(p3->getNormal().normalized().f[1]);
-        flag_vertices.push_back(p3->getNormal().normalized().f[2]);
+	/* timeStep(fields) in parts on bands of rows, for the tasks of a FlagWorld when solvesInBands(): beginStepRows() once,
+	then CONSTRAINT_ITERATIONS sweeps satisfyRows() of every band, the sweep i of a band after the sweep i of the band above
+	and after the sweep i-1 of the band below (the wavefront of buildFrameGraph()), then integrateRows() of every band and endStepRows() once.
+	A band has at least STENCIL_REACH rows */
+	void beginStepRows()
+	{
+		if (interpolation_enabled)
+		{
+			previous_x = particles.pos_x;
+			previous_y = particles.pos_y;
+			previous_z = particles.pos_z;
+		}
+		iterations = CONSTRAINT_ITERATIONS;
 	}
-    GLuint VAO,VBO;
-    std::vector<float> flag_vertices;
-public:
+	void satisfyRows(int y_first, int y_last)
+	{
+		StencilSolver stencil(layout, num_particles_width, num_particles_height, cell_width, cell_height);
+		stencil.satisfyBand(particles, y_first, y_last);
+	}
+	template<typename Fields>
+	void integrateRows(const Fields &fields, int y_first, int y_last)
+	{
+		particles.timeStep(fields, y_first * num_particles_width, y_last * num_particles_width); // row major
+	}
+	void endStepRows() {triangles.invalidate(); step_count++;}
 
-	/* This is a important constructor for the entire system of particles and constraints*/
-	Flag(float width, float height, int num_particles_width, int num_particles_height) : num_particles_width(num_particles_width), num_particles_height(num_particles_height)
+	/* the triangle cache is complete once buildTrianglesRows() covered every row of quads after the last time step, the next wind reuses it */
+	void validateTriangles() {triangles.validate();}
+
+	/* a whole frame: the gravity and the wind, the time step, the normals (unless setShaderNormals()) and the vertices drawn by draw() */
+	void simulateFrame(const Vec3 &gravity, const Vec3 &wind)
 	{
-		particles.resize(num_particles_width*num_particles_height);
-		float mass_particle = MASS/num_particles_width*num_particles_height;
+		if (!pipelined || !solvesInBands())
+		{
+			addForce(gravity);
+			addwindForce(wind);
+			timeStep();
+			if (!shader_normals)
+				updateNormals();
+			buildVertices();
+			return;
+		}
+		if (frame_graph.empty())
+			buildFrameGraph();
+		if (interpolation_enabled)
+		{
+			previous_x = particles.pos_x;
+			previous_y = particles.pos_y;
+			previous_z = particles.pos_z;
+		}
+		frame_gravity = gravity;
+		frame_wind = wind;
+		iterations = CONSTRAINT_ITERATIONS;
+		flag_vertices.resize((size_t)particles.size() * 6);
+		vertex_packer = VertexPacker();
+		vertex_source = {particles.pos_x.data(), particles.pos_y.data(), particles.pos_z.data(),
+		                 nullptr, nullptr, nullptr,
+		                 particles.normal_x.data(), particles.normal_y.data(), particles.normal_z.data(), 1.0f}; // the positions of this frame
+		frame_graph.run(*thread_pool); // the wind of a band reads the cached triangles of its quads before the band rebuilds them
+		triangles.validate(); // every band built its triangles at the new positions
+		step_count++;
+		if (!shader_normals)
+			normals_step = step_count; // every band gathered its normals
+	}
 
-		for(int x=0; x<num_particles_width; x++)
+	/* draws the vertices built by simulateFrame() or buildVertices(), copied to the vertex buffer */
+	void draw()
+	{
+		if (flag_vertices.size() != (size_t)particles.size() * 6)
+			return;
+		if (shader_normals)
 		{
-			for(int y=0; y<num_particles_height; y++)
+			float *position = (float*)vertex_ring.map(particles.size(), VertexFormat::Position);
+			for(int y = 0; y<num_particles_height; y++)
 			{
-				Vec3 pos = Vec3(width * (x/(float)num_particles_width),
-								height * (y/(float)num_particles_height),
-								0);
-				particles[y*num_particles_width+x]= Particle(pos,0.0001); // insert particle in column x at y'th row
+				for(int x = 0; x<num_particles_width; x++, position += 3)
+					std::copy_n(flag_vertices.begin() + (size_t)getParticle(x,y) * 6, 3, position);
 			}
+			vertex_ring.draw(flag_indices, indices_version, VertexPacker(VertexFormat::Position), num_particles_width, num_particles_height);
+			return;
 		}
-
-		// Connecting immediate neighbor particles with constraints (distance 1 and sqrt(2) in the grid)
-		for(int x=0; x<num_particles_width; x++)
+		VertexPacker packer(vertex_format);
+		if (vertex_format == VertexFormat::Quantized)
 		{
-			for(int y=0; y<num_particles_height; y++)
+			float minimum[3] = {INFINITY, INFINITY, INFINITY}, maximum[3] = {-INFINITY, -INFINITY, -INFINITY};
+			for (size_t v = 0; v < flag_vertices.size(); v += 6)
 			{
-				if (x<num_particles_width-1) makeConstraint(getParticle(x,y),getParticle(x+1,y));
-				if (y<num_particles_height-1) makeConstraint(getParticle(x,y),getParticle(x,y+1));
-				if (x<num_particles_width-1 && y<num_particles_height-1) makeConstraint(getParticle(x,y),getParticle(x+1,y+1));
-				if (x<num_particles_width-1 && y<num_particles_height-1) makeConstraint(getParticle(x+1,y),getParticle(x,y+1));
+				for (int c = 0; c < 3; c++)
+				{
+					minimum[c] = std::min(minimum[c], flag_vertices[v + c]);
+					maximum[c] = std::max(maximum[c], flag_vertices[v + c]);
+				}
 			}
+			packer.fit(minimum, maximum);
 		}
+		unsigned char *vertex = vertex_ring.map(particles.size(), vertex_format);
+		for (size_t v = 0; v < flag_vertices.size(); v += 6)
+			packer.store(flag_vertices[v], flag_vertices[v+1], flag_vertices[v+2], flag_vertices[v+3], flag_vertices[v+4], flag_vertices[v+5], vertex);
+		vertex_ring.draw(flag_indices, indices_version, packer);
+	}
 
-		// Connecting secondary neighbors with constraints (distance 2 and sqrt(4) in the grid)
-		for(int x=0; x<num_particles_width; x++)
+private:
+	/* The tasks of a frame, on bands of FRAME_BAND_ROWS rows, each one waiting for the tasks whose rows it reads or writes:
+	- forces of the band b: the gravity of the next band (of the band 0 too for the first one), then the wind of the quads of b,
+	  after the forces of b-1 so that the forces add up in the order of addForce() then addwindForce()
+	- iteration i of the band b: the stencil of its rows, after the iteration i of b-1 (the order of a sweep), after the iteration i-1 of b+1
+	  (the iteration i-1 is done with every row it moves) and for i = 0 after the forces of b+1, which read the rows it moves
+	- integration of the band b: after the last iteration of b
+	- triangles of the quads of the band b: after the integration of b and b+1
+	- normals of the band b, gathered from the triangles around its particles: after the triangles of b-1 and b
+	- vertices of the particles of the band b: after the normals of b
+	So the forces of the last bands overlap the first iteration of the first bands, the iterations follow a wavefront,
+	and the normals and vertices of the first bands are built while the last bands are being solved. A row of the stencil only moves
+	the STENCIL_REACH rows below it, the tasks running together touch distinct rows and the result is the one of the phases in sequence. */
+	void buildFrameGraph()
+	{
+		const int num_bands = (num_particles_height + FRAME_BAND_ROWS - 1) / FRAME_BAND_ROWS;
+		std::vector<int> forces(num_bands), iteration(num_bands), previous_iteration(num_bands), integration(num_bands), triangle_rows(num_bands), normals(num_bands);
+		for (int b = 0; b < num_bands; b++)
+		{
+			forces[b] = frame_graph.add(&Flag::forcesTask, this, b);
+			frame_graph.depend(forces[b], b > 0 ? forces[b-1] : -1);
+		}
+		for (int i = 0; i < CONSTRAINT_ITERATIONS; i++)
 		{
-			for(int y=0; y<num_particles_height; y++)
+			previous_iteration.swap(iteration);
+			for (int b = 0; b < num_bands; b++)
 			{
-				if (x<num_particles_width-2) makeConstraint(getParticle(x,y),getParticle(x+2,y));
-				if (y<num_particles_height-2) makeConstraint(getParticle(x,y),getParticle(x,y+2));
-				if (x<num_particles_width-2 && y<num_particles_height-2) makeConstraint(getParticle(x,y),getParticle(x+2,y+2));
-				if (x<num_particles_width-2 && y<num_particles_height-2) makeConstraint(getParticle(x+2,y),getParticle(x,y+2));			
-            }
+				iteration[b] = frame_graph.add(&Flag::iterationTask, this, b);
+				frame_graph.depend(iteration[b], b > 0 ? iteration[b-1] : -1);
+				if (i == 0)
+					frame_graph.depend(iteration[b], forces[std::min(b+1, num_bands-1)]);
+				else
+					frame_graph.depend(iteration[b], previous_iteration[std::min(b+1, num_bands-1)]);
+			}
+		}
+		for (int b = 0; b < num_bands; b++)
+		{
+			integration[b] = frame_graph.add(&Flag::integrationTask, this, b);
+			frame_graph.depend(integration[b], iteration[b]);
+		}
+		for (int b = 0; b < num_bands; b++)
+		{
+			triangle_rows[b] = frame_graph.add(&Flag::trianglesTask, this, b);
+			frame_graph.depend(triangle_rows[b], integration[b]);
+			frame_graph.depend(triangle_rows[b], b+1 < num_bands ? integration[b+1] : -1);
+		}
+		for (int b = 0; b < num_bands; b++)
+		{
+			normals[b] = frame_graph.add(&Flag::normalsTask, this, b);
+			frame_graph.depend(normals[b], b > 0 ? triangle_rows[b-1] : -1);
+			frame_graph.depend(normals[b], triangle_rows[b]);
+		}
+		for (int b = 0; b < num_bands; b++)
+		{
+			const int vertices = frame_graph.add(&Flag::verticesTask, this, b);
+			frame_graph.depend(vertices, normals[b]);
 		}
+	}
 
-        for(int j=0;j<num_particles_width; j++)
-        {
-            getParticle(0 ,j)->makeUnmovable(); 
-        }
+	int bandFirst(int band) const {return band * FRAME_BAND_ROWS;}
+	int bandLast(int band) const {return std::min((band + 1) * FRAME_BAND_ROWS, num_particles_height);}
+
+	static void forcesTask(void *context, int band)
+	{
+		Flag &flag = *(Flag*)context;
+		if (band == 0)
+			flag.addForceRows(flag.frame_gravity, flag.bandFirst(0), flag.bandLast(0));
+		flag.addForceRows(flag.frame_gravity, flag.bandFirst(band+1), flag.bandLast(band+1));
+		flag.addwindForceRows(flag.frame_wind, flag.bandFirst(band), flag.bandLast(band));
 	}
 
-	/* drawing the Flag as a smooth shaded (and colored according to column) OpenGL triangular mesh
-	Called from the display() method
-	The Flag is seen as consisting of triangles for four particles in the grid as follows:
+	static void iterationTask(void *context, int band)
+	{
+		Flag &flag = *(Flag*)context;
+		flag.satisfyRows(flag.bandFirst(band), flag.bandLast(band));
+	}
 
-	(x+1,y) *--* (x+1,y+1)
-	        | /|
-	        |/ |
-	(x,y)   *--* (x,y+1)
+	static void integrationTask(void *context, int band)
+	{
+		Flag &flag = *(Flag*)context;
+		flag.particles.timeStep(flag.bandFirst(band) * flag.num_particles_width, flag.bandLast(band) * flag.num_particles_width); // row major
+	}
 
-	*/
-	void render()
+	static void trianglesTask(void *context, int band)
 	{
-		// reset normals (which where written to last frame)
-		std::vector<Particle>::iterator particle;
-		for(particle = particles.begin(); particle != particles.end(); particle++)
+		Flag &flag = *(Flag*)context;
+		flag.buildTrianglesRows(flag.bandFirst(band), flag.bandLast(band));
+	}
+
+	static void normalsTask(void *context, int band)
+	{
+		Flag &flag = *(Flag*)context;
+		if (!flag.shader_normals) // the vertex shader derives them
+			flag.gatherNormalsRows(flag.bandFirst(band), flag.bandLast(band));
+	}
+
+	static void verticesTask(void *context, int band)
+	{
+		Flag &flag = *(Flag*)context;
+		flag.addVerticesRows(flag.bandFirst(band), flag.bandLast(band));
+	}
+
+	template<typename Fields>
+	void solveAndIntegrate(const Fields &fields)
+	{
+		iterations = CONSTRAINT_ITERATIONS;
+
+		if (solver_mode == SolverMode::Stencil || solver_mode == SolverMode::Blocked || solver_mode == SolverMode::Multigrid)
+		{
+			StencilSolver stencil(layout, num_particles_width, num_particles_height, cell_width, cell_height, sleeping_enabled ? &sleep_tracker : nullptr);
+			if (solver_mode == SolverMode::Multigrid)
+				multigrid_solver.solveCoarse(particles, layout, sleeping_enabled ? &sleep_tracker : nullptr);
+			if (solver_mode == SolverMode::Blocked)
+				stencil.satisfyBlocked(particles, CONSTRAINT_ITERATIONS);
+			else
+			{
+				if (chebyshev_enabled)
+					chebyshev.begin(particles);
+				float previous_violation = INFINITY;
+				for(iterations=0; iterations<max_iterations;)
+				{
+					float violation = sqrtf(stencil.satisfy(particles) / stencil.numConstraints());
+					if (chebyshev_enabled)
+						chebyshev.accelerate(particles, iterations);
+					iterations++;
+					if (isConverged(violation, previous_violation))
+						break;
+					previous_violation = violation;
+				}
+			}
+			particles.timeStep(fields);
+			return;
+		}
+
+		if (solver_mode == SolverMode::Xpbd)
 		{
-			(*particle).resetNormal();
+			iterations = substep_scheduler.substeps * substep_scheduler.iterations;
+			xpbd_solver.step(particles, rest_lengths, substep_scheduler, fields); // integrates the particles in every substep
+			return;
 		}
 
-		//create smooth per particle normals by adding up all the (hard) triangle normals that each particle is part of
-		for(int x = 0; x<num_particles_width-1; x++)
+		if (solver_mode == SolverMode::Colored)
 		{
-			for(int y=0; y<num_particles_height-1; y++)
+			const int num_threads = thread_pool->size();
+			SpinBarrier barrier(num_threads);
+			thread_pool->run([&](int t)
 			{
-				Vec3 normal = calcTriangleNormal(getParticle(x+1,y),getParticle(x,y),getParticle(x,y+1));
-				getParticle(x+1,y+1)->addToNormal(normal);
-				getParticle(x+1,y)->addToNormal(normal);
-				getParticle(x,y)->addToNormal(normal);
-
-				normal = calcTriangleNormal(getParticle(x+1,y+1),getParticle(x+1,y),getParticle(x,y+1));
-				getParticle(x+1,y+1)->addToNormal(normal);
-				getParticle(x,y)->addToNormal(normal);
-				getParticle(x,y+1)->addToNormal(normal);
-			}
+				for(int i=0; i<CONSTRAINT_ITERATIONS; i++)
+				{
+					satisfyConstraintColors(particles, constraint_colors, rest_lengths, t, num_threads, num_threads > 1 ? &barrier : nullptr);
+				}
+			});
+			particles.timeStep(fields);
+			return;
 		}
 
-		for(int x = 0; x<num_particles_width-1; x++)
+		if (solver_mode == SolverMode::Jacobi)
 		{
-			for(int y=0; y<num_particles_height-1; y++)
+			const int num_threads = thread_pool->size();
+			SpinBarrier barrier(num_threads);
+			thread_pool->run([&](int t)
 			{
-				AddTriangle(getParticle(x,y),getParticle(x,y+1),getParticle(x+1,y+1));
-				AddTriangle(getParticle(x,y),getParticle(x+1,y),getParticle(x+1,y+1));
-			}
+				jacobi_solver.solve(particles, rest_lengths, CONSTRAINT_ITERATIONS, t, num_threads, num_threads > 1 ? &barrier : nullptr);
+			});
+			jacobi_solver.finish(particles);
+			particles.timeStep(fields);
+			return;
 		}
 
-		// setup VAO
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glBindVertexArray(VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, flag_vertices.size() * sizeof(float), &flag_vertices[0], GL_STATIC_DRAW);
-		// position attribute
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
-		// Normal attribute
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
+		std::vector<Constraint>::iterator constraint;
+		if (chebyshev_enabled)
+			chebyshev.begin(particles);
+		const int iteration_cap = solver_mode == SolverMode::Batched ? CONSTRAINT_ITERATIONS : max_iterations;
+		float previous_violation = INFINITY;
+		for(iterations=0; iterations<iteration_cap;) // iterate over all constraints several times
+		{
+			float violation = 0.0f; // sum of the squared violations
+			if (solver_mode == SolverMode::Batched)
+				satisfyConstraintBatches(particles, constraint_batches, rest_lengths); // the kernels measure no violation
+			else
+				for(constraint = constraints.begin(); constraint != constraints.end(); constraint++ )
+				{
+					float v;
+					if (sleeping_enabled && !(sleep_tracker.isActive(constraint->p1) && sleep_tracker.isActive(constraint->p2)))
+					{
+						// the particles of the inactive tiles are held where they are, until the move of the active tiles wakes their tile
+						const uint32_t p1 = constraint->p1, p2 = constraint->p2;
+						if (sleep_tracker.isActive(p1))
+							v = satisfyConstraintHeld(particles, p1, p2, rest_lengths[constraint->rest_id]);
+						else if (sleep_tracker.isActive(p2))
+							v = satisfyConstraintHeld(particles, p2, p1, rest_lengths[constraint->rest_id]);
+						else
+							continue; // both tiles are inactive
+					}
+					else
+						v = (*constraint).satisfyConstraint(particles, rest_lengths); // satisfy constraint.
+					violation += v*v;
+				}
+			violation = sqrtf(violation / constraints.size());
+			if (chebyshev_enabled)
+				chebyshev.accelerate(particles, iterations);
+			iterations++;
+			if (solver_mode != SolverMode::Batched && isConverged(violation, previous_violation))
+				break;
+			previous_violation = violation;
+		}
+		particles.timeStep(fields); // calculate the position of each particle at the next time step.
+	}
 
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, num_particles_width * num_particles_height * 2 * 3);
-        glBindVertexArray(0);
-		
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
+	/* the sleeping tiles are at rest under the forces of the previous time step, other forces wake them */
+	void wakeOnForceChange(Vec3 &last, const Vec3 &force)
+	{
+		if (sleeping_enabled && sleep_tracker.isBuilt() && (force.f[0] != last.f[0] || force.f[1] != last.f[1] || force.f[2] != last.f[2]))
+			sleep_tracker.wakeAll(particles);
+		last = force;
+	}
 
-		flag_vertices.clear();
+	/* the wind on the two triangles of the quad whose corner (x,y) is the particle i */
+	void addQuadWind(int i, int x, int y, const Vec3 &direction)
+	{
+		int p1 = i;
+		int p2 = getParticle(x+1,y);
+		int p3 = getParticle(x,y+1);
+		int p4 = getParticle(x+1,y+1);
+		Vec3 normal = calcTriangleNormal(p2,p1,p3);
+		Vec3 d = normal.normalized();
+		Vec3 force = normal*(d.dot(direction));
+		particles.addForce(p1,force);
+		particles.addForce(p2,force);
+		particles.addForce(p3,force);
+
+		normal = calcTriangleNormal(p4,p2,p3);
+		d = normal.normalized();
+		force = normal*(d.dot(direction));
+		particles.addForce(p2,force);
+		particles.addForce(p3,force);
+		particles.addForce(p4,force);
 	}
 
-	/* this is an important methods where the time is progressed one time step for the entire Flag.
-	This includes calling satisfyConstraint() for every constraint, and calling timeStep() for all particles
-	*/
-	void timeStep()
+	/* addQuadWind() from the triangles of the quad q of the cache, whose corners are (x,y)=p1, (x+1,y)=p2, (x,y+1)=p3 and (x+1,y+1)=p4 */
+	void addCachedQuadWind(const TriangleCache &cache, int q, int p1, int p2, int p3, int p4, const Vec3 &direction)
 	{
-		std::vector<Constraint>::iterator constraint;
-		for(int i=0; i<CONSTRAINT_ITERATIONS; i++) // iterate over all constraints several times
+		Vec3 d = Vec3(cache.unit[0][0][q], cache.unit[0][1][q], cache.unit[0][2][q]);
+		Vec3 force = Vec3(cache.cross[0][0][q], cache.cross[0][1][q], cache.cross[0][2][q])*(d.dot(direction));
+		particles.addForce(p1,force);
+		particles.addForce(p2,force);
+		particles.addForce(p3,force);
+
+		d = Vec3(cache.unit[1][0][q], cache.unit[1][1][q], cache.unit[1][2][q]);
+		force = Vec3(cache.cross[1][0][q], cache.cross[1][1][q], cache.cross[1][2][q])*(d.dot(direction));
+		particles.addForce(p2,force);
+		particles.addForce(p3,force);
+		particles.addForce(p4,force);
+	}
+	/* updateNormals() for the active tiles only: the normals of the particles of the inactive tiles, whose neighborhood did not move,
+	are kept, the quads touching an active particle only add to the active particles, which are normalized at the end */
+	void updateActiveNormals()
+	{
+		for(int i = 0; i<particles.size(); i++)
 		{
-			for(constraint = constraints.begin(); constraint != constraints.end(); constraint++ )
+			if (sleep_tracker.isActive(i))
 			{
-				(*constraint).satisfyConstraint(); // satisfy constraint.
+				particles.normal_x[i] = 0.0f;
+				particles.normal_y[i] = 0.0f;
+				particles.normal_z[i] = 0.0f;
 			}
 		}
-		std::vector<Particle>::iterator particle;
-		for(particle = particles.begin(); particle != particles.end(); particle++)
+
+		for(int i = 0; i<particles.size(); i++) // quads in the layout order
 		{
-			particle->timeStep(); // calculate the position of each particle at the next time step.
+			int x = layout.x(i), y = layout.y(i);
+			if (x>=num_particles_width-1 || y>=num_particles_height-1)
+				continue;
+			const int quad[4] = {i, getParticle(x+1,y), getParticle(x,y+1), getParticle(x+1,y+1)};
+			bool active[4];
+			for(int k=0; k<4; k++)
+				active[k] = sleep_tracker.isActive(quad[k]);
+			if (!active[0] && !active[1] && !active[2] && !active[3])
+				continue;
+
+			Vec3 normal = calcTriangleNormal(quad[1],quad[0],quad[2]);
+			if (active[3]) particles.addToNormal(quad[3],normal);
+			if (active[1]) particles.addToNormal(quad[1],normal);
+			if (active[0]) particles.addToNormal(quad[0],normal);
+
+			normal = calcTriangleNormal(quad[3],quad[1],quad[2]);
+			if (active[3]) particles.addToNormal(quad[3],normal);
+			if (active[0]) particles.addToNormal(quad[0],normal);
+			if (active[2]) particles.addToNormal(quad[2],normal);
+		}
+
+		for(int i = 0; i<particles.size(); i++)
+		{
+			if (sleep_tracker.isActive(i))
+			{
+				Vec3 normal = particles.getNormal(i).normalized();
+				particles.normal_x[i] = normal.f[0];
+				particles.normal_y[i] = normal.f[1];
+				particles.normal_z[i] = normal.f[2];
+			}
 		}
 	}
 
+public:
 	/* used to add gravity (or any other arbitrary vector) to all particles*/
 	void addForce(const Vec3 force)
 	{
-		std::vector<Particle>::iterator particle;
-		for(particle = particles.begin(); particle != particles.end(); particle++)
+		wakeOnForceChange(last_force, force);
+		particles.addForceAll(force); // add the forces to each particle, the integration drops it for the sleeping ones
+	}
+
+	/* addForce() and addwindForce() for the rows y_first <= y < y_last only, so that bands of rows of a large flag can run on several threads
+	(see FlagWorld): the wind of the quads of a band also moves the first row of the next band, the bands next to each other must not run together.
+	The sleeping tiles are neither skipped nor woken up, the flags of a FlagWorld do not sleep */
+	void addForceRows(const Vec3 force, int y_first, int y_last)
+	{
+		for(int y = y_first; y < y_last; y++)
+			for(int x = 0; x < num_particles_width; x++)
+				particles.addForce(getParticle(x,y), force);
+	}
+	void addwindForceRows(const Vec3 direction, int y_first, int y_last)
+	{
+		for(int y = y_first; y < std::min(y_last, num_particles_height-1); y++)
 		{
-			particle->addForce(force); // add the forces to each particle
+			for(int x = 0; x < num_particles_width-1; x++)
+			{
+				if (triangles.isValid()) // left by the last pipelined frame or FlagWorld frame
+					addCachedQuadWind(triangles, y*(num_particles_width-1) + x, getParticle(x,y), getParticle(x+1,y), getParticle(x,y+1), getParticle(x+1,y+1), direction);
+				else
+					addQuadWind(getParticle(x,y),x,y,direction);
+			}
 		}
-
 	}
 
-	/* used to add wind forces to all particles, is added for each triangle since the final force is proportional to the triangle area as seen from the wind direction*/
+	/* used to add wind forces to all particles, is added for each triangle since the final force is proportional to the triangle area as seen from the wind direction.
+	The triangles come from the triangle cache, already filled by the updateNormals() of the last frame. With sleeping tiles only the active quads are computed */
 	void addwindForce(const Vec3 direction)
 	{
-		for(int x = 0; x<num_particles_width-1; x++)
+		wakeOnForceChange(last_wind, direction);
+		const bool skip_inactive = sleeping_enabled && sleep_tracker.isBuilt() && sleep_tracker.numSleeping() > 0;
+		if (!skip_inactive && layout.type() == ParticleLayout::RowMajor) // the layout order is the order of the rows
 		{
-			for(int y=0; y<num_particles_height-1; y++)
-			{
-				Particle* p1 = getParticle(x,y);
-				Particle* p2 = getParticle(x+1,y);
-				Particle* p3 = getParticle(x,y+1);
-				Particle* p4 = getParticle(x+1,y+1);
-				Vec3 normal = calcTriangleNormal(p2,p1,p3);
-				Vec3 d = normal.normalized();
-				Vec3 force = normal*(d.dot(direction));
-				p1->addForce(force);
-				p2->addForce(force);
-				p3->addForce(force);
-
-
-				normal = calcTriangleNormal(p4,p2,p3);
-				d = normal.normalized();
-				force = normal*(d.dot(direction));
-				p2->addForce(force);
-				p3->addForce(force);
-				p4->addForce(force);
-			}
+			const TriangleCache &cache = triangleCache();
+			const int w = num_particles_width;
+			for(int y = 0; y<num_particles_height-1; y++)
+				for(int x = 0, i = y*w; x<w-1; x++, i++)
+					addCachedQuadWind(cache, y*(w-1) + x, i, i+1, i+w, i+w+1, direction);
+			return;
+		}
+		const TriangleCache *cache = skip_inactive && !triangles.isValid() ? nullptr : &triangleCache();
+		for(int i = 0; i<particles.size(); i++) // quads in the layout order
+		{
+			int x = layout.x(i), y = layout.y(i);
+			if (x>=num_particles_width-1 || y>=num_particles_height-1)
+				continue;
+			if (skip_inactive && !sleep_tracker.isActive(i))
+				continue; // the quad lies in the sleeping tiles
+
+			if (cache)
+				addCachedQuadWind(*cache, y*(num_particles_width-1) + x, i, getParticle(x+1,y), getParticle(x,y+1), getParticle(x+1,y+1), direction);
+			else
+				addQuadWind(i,x,y,direction);
 		}
 	}
 
 };
+#endif
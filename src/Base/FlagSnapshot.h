@@ -0,0 +1,18 @@
+#ifndef FLAG_SNAPSHOT_H
+#define FLAG_SNAPSHOT_H
+
+#include <vector>
+
+/* What render() needs of a Flag after a time step, copied by Flag::writeSnapshot() so that the simulation thread
+can step the Flag again while the render thread draws it. The arrays are in the layout order of the Flag,
+they keep their capacity from one snapshot to the next so that publishing does not allocate.
+*/
+struct FlagSnapshot
+{
+	std::vector<float> pos_x, pos_y, pos_z; // the positions after the last time step
+	std::vector<float> previous_x, previous_y, previous_z; // the positions before it, for the interpolation of render()
+	std::vector<float> normal_x, normal_y, normal_z; // unit normals of the positions after the last time step
+	double time = 0.0; // when the snapshot was published, in seconds of the clock of the simulation thread
+	long long steps = 0; // how many time steps the simulation thread ran up to this snapshot
+};
+#endif
@@ -0,0 +1,206 @@
+#ifndef FLAG_WORLD_H
+#define FLAG_WORLD_H
+
+#include <Base/Flag.cpp>
+#include <Base/WorkStealingPool.h>
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define FLAG_WORLD_BAND_ROWS 32 // the rows of a band, the flags with at least two bands split their frame in bands, at least STENCIL_REACH
+
+/* Many flags of different sizes stepped together on a WorkStealingPool. Each flag runs its frame as a chain of stages:
+the wind, the time step (the gravity is a force field of its integration, see ForceFields.h), then the normals. A small flag runs the whole chain as one task. A large flag splits its stages
+in bands of FLAG_WORLD_BAND_ROWS rows, one task per band. The wind of the even bands runs first, then the odd ones, since the quads of a band
+also move the first row of the next band. When the flag solvesInBands(), its constraints are solved by one task per band and sweep: the sweep i of a band
+is submitted by the last of the sweep i of the band above and the sweep i-1 of the band below, so the sweeps follow a wavefront, the result
+is the one of Flag::timeStep(), and as many bands as sweeps are solved at once. The integration then runs on all the bands at once.
+Otherwise the time step of the flag is one task, its solver runs on one thread (the flag is built with a pool of one thread).
+The normals are gathered (see TriangleCache.h): every band builds its triangles, then every band gathers its normals, all the bands at once,
+and the wind of the next frame reuses the triangles.
+The last task of a stage submits the next stage, so the flags never wait for each other and the threads steal the bands of the large flags once the small flags are done.
+*/
+class FlagWorld
+{
+public:
+	explicit FlagWorld(int num_threads = (int)std::thread::hardware_concurrency()) : pool(std::max(num_threads, 1)) {}
+
+	/* returns the index of the new flag, it uses the Stencil solver on one thread until changed with getFlag() */
+	int addFlag(float width, float height, int num_particles_width, int num_particles_height)
+	{
+		std::unique_ptr<Job> job(new Job());
+		job->flag.reset(new Flag(width, height, num_particles_width, num_particles_height, 1)); // no thread of its own, the pool of the world runs its tasks
+		job->flag->setSolverMode(SolverMode::Stencil);
+		job->height = num_particles_height;
+		job->num_bands = (num_particles_height + FLAG_WORLD_BAND_ROWS - 1) / FLAG_WORLD_BAND_ROWS;
+		job->waiting.reset(new std::atomic<int>[CONSTRAINT_ITERATIONS * job->num_bands]);
+		job->num_particles = (long long)num_particles_width * num_particles_height;
+		jobs.push_back(std::move(job));
+		num_particles += jobs.back()->num_particles;
+		return (int)jobs.size() - 1;
+	}
+
+	int numFlags() const {return (int)jobs.size();}
+	long long numParticles() const {return num_particles;}
+	Flag &getFlag(int index) {return *jobs[index]->flag;}
+
+	/* the gravity and the wind applied to the flag at every time step */
+	void setForces(int index, const Vec3 &gravity, const Vec3 &wind)
+	{
+		jobs[index]->gravity = gravity;
+		jobs[index]->wind = wind;
+	}
+
+	/* one time step of every flag, the normals included */
+	void timeStep()
+	{
+		auto start = std::chrono::steady_clock::now();
+		// the largest flags first, their stages have the longest chains
+		std::vector<Job*> order;
+		for (std::unique_ptr<Job> &job : jobs)
+			order.push_back(job.get());
+		std::sort(order.begin(), order.end(), [](const Job *a, const Job *b) {return a->num_particles > b->num_particles;});
+		for (Job *job : order)
+			submitStage(job, job->num_bands >= 2 ? EVEN_FORCES : WHOLE_FRAME);
+		pool.wait();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		last_seconds = elapsed.count();
+		total_seconds += last_seconds;
+		total_steps++;
+	}
+
+	/* the particles stepped per second of the last time step, and on average since the first one */
+	double particleStepsPerSecond() const {return last_seconds > 0.0 ? num_particles / last_seconds : 0.0;}
+	double averageParticleStepsPerSecond() const {return total_seconds > 0.0 ? num_particles * total_steps / total_seconds : 0.0;}
+	int numThreads() const {return pool.size();}
+
+private:
+	enum Stage {WHOLE_FRAME, EVEN_FORCES, ODD_FORCES, STEP, SOLVE, INTEGRATION, TRIANGLES, NORMALS, DONE};
+
+	struct Job
+	{
+		std::unique_ptr<Flag> flag;
+		Vec3 gravity = Vec3(0,0,0), wind = Vec3(0,0,0);
+		int height = 0, num_bands = 0;
+		long long num_particles = 0;
+		std::atomic<int> remaining{0}; // the tasks of the current stage not done yet
+		std::unique_ptr<std::atomic<int>[]> waiting; // the sweeps i*num_bands + band of the SOLVE stage wait for this many sweeps still
+	};
+
+	std::vector<std::unique_ptr<Job>> jobs;
+	WorkStealingPool pool;
+	long long num_particles = 0;
+	double last_seconds = 0.0, total_seconds = 0.0;
+	long long total_steps = 0;
+
+	Stage nextStage(Job *job, Stage stage) const
+	{
+		switch (stage)
+		{
+		case WHOLE_FRAME: return DONE;
+		case ODD_FORCES: return job->flag->solvesInBands() ? SOLVE : STEP;
+		case STEP: return TRIANGLES;
+		default: return (Stage)(stage + 1);
+		}
+	}
+
+	void submitStage(Job *job, Stage stage)
+	{
+		if (stage == DONE)
+			return;
+		if (stage == SOLVE)
+		{
+			job->flag->beginStepRows();
+			job->remaining = CONSTRAINT_ITERATIONS * job->num_bands;
+			for (int i = 0; i < CONSTRAINT_ITERATIONS; i++)
+			{
+				for (int band = 0; band < job->num_bands; band++)
+					job->waiting[i * job->num_bands + band] = (band > 0 ? 1 : 0) + (i > 0 ? 1 : 0);
+			}
+			pool.submit([this, job]() {runSweep(job, 0, 0);});
+			return;
+		}
+		if (stage == WHOLE_FRAME || stage == STEP)
+		{
+			job->remaining = 1;
+			pool.submit([this, job, stage]() {runStage(job, stage, 0);});
+			return;
+		}
+		const int first_band = stage == ODD_FORCES ? 1 : 0;
+		const int band_step = (stage == EVEN_FORCES || stage == ODD_FORCES) ? 2 : 1;
+		job->remaining = (job->num_bands - first_band + band_step - 1) / band_step;
+		for (int band = first_band; band < job->num_bands; band += band_step)
+			pool.submit([this, job, stage, band]() {runStage(job, stage, band);});
+	}
+
+	void runStage(Job *job, Stage stage, int band)
+	{
+		Flag &flag = *job->flag;
+		const int y_first = band * FLAG_WORLD_BAND_ROWS;
+		const int y_last = std::min(y_first + FLAG_WORLD_BAND_ROWS, job->height);
+		switch (stage)
+		{
+		case WHOLE_FRAME:
+			flag.addwindForce(job->wind);
+			flag.timeStep(makeForcePipeline(GravityField(job->gravity * (1.0f / MASS)))); // the gravity in the pass of the integration
+			flag.updateNormals();
+			break;
+		case EVEN_FORCES:
+		case ODD_FORCES:
+			flag.addwindForceRows(job->wind, y_first, y_last);
+			break;
+		case STEP:
+			flag.timeStep(makeForcePipeline(GravityField(job->gravity * (1.0f / MASS))));
+			break;
+		case INTEGRATION:
+			flag.integrateRows(makeForcePipeline(GravityField(job->gravity * (1.0f / MASS))), y_first, y_last);
+			break;
+		case SOLVE:
+			assert(!"the sweeps of the SOLVE stage run in runSweep()");
+			break;
+		case TRIANGLES:
+			flag.buildTrianglesRows(y_first, y_last);
+			break;
+		case NORMALS:
+			flag.gatherNormalsRows(y_first, y_last);
+			break;
+		case DONE:
+			break;
+		}
+		if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			if (stage == INTEGRATION)
+				flag.endStepRows();
+			if (stage == TRIANGLES)
+				flag.validateTriangles(); // every band built its triangles, the wind of the next frame reads them
+			submitStage(job, nextStage(job, stage));
+		}
+	}
+
+	/* the sweep i of the constraints of a band in the SOLVE stage, then the sweeps waiting for it: the sweep i of the band below,
+	the sweep i+1 of the band above, and the sweep i+1 of the last band after its sweep i */
+	void runSweep(Job *job, int i, int band)
+	{
+		job->flag->satisfyRows(band * FLAG_WORLD_BAND_ROWS, std::min((band + 1) * FLAG_WORLD_BAND_ROWS, job->height));
+		if (band + 1 < job->num_bands)
+			releaseSweep(job, i, band + 1);
+		if (i + 1 < CONSTRAINT_ITERATIONS && band > 0)
+			releaseSweep(job, i + 1, band - 1);
+		if (i + 1 < CONSTRAINT_ITERATIONS && band == job->num_bands - 1)
+			releaseSweep(job, i + 1, band);
+		if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			submitStage(job, INTEGRATION);
+	}
+
+	void releaseSweep(Job *job, int i, int band)
+	{
+		if (job->waiting[i * job->num_bands + band].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			pool.submit([this, job, i, band]() {runSweep(job, i, band);});
+	}
+};
+#endif
@@ -0,0 +1,88 @@
+#ifndef FORCE_FIELDS_H
+#define FORCE_FIELDS_H
+
+#include <Base/Vec3.h>
+
+#include <tuple>
+#include <utility>
+
+/* Force fields applied by the integration itself: each field adds to the acceleration of a particle from its position and its velocity
+(the displacement of the last time step, pos - old), and a ForcePipeline sums its fields at compile time, in registers, inside the verlet loop
+of ParticleStore::timeStep(fields). A field needs no sweep of its own over the particles, unlike Flag::addForce() which writes every acceleration
+before the integration reads it back. The wind stays a pass over the quads (Flag::addwindForce()): it depends on the triangles, not on a particle.
+A field is any class with the method
+	void accelerate(float x, float y, float z, float vx, float vy, float vz, float &ax, float &ay, float &az) const
+*/
+
+/* a constant acceleration, the force of Flag::addForce() divided by the mass */
+struct GravityField
+{
+	float gx, gy, gz;
+
+	explicit GravityField(const Vec3 &acceleration) : gx(acceleration.f[0]), gy(acceleration.f[1]), gz(acceleration.f[2]) {}
+
+	void accelerate(float, float, float, float, float, float, float &ax, float &ay, float &az) const
+	{
+		ax += gx; ay += gy; az += gz;
+	}
+};
+
+/* air friction against the velocity, on top of the DAMPING of the integration */
+struct DragField
+{
+	float coefficient;
+
+	explicit DragField(float coefficient) : coefficient(coefficient) {}
+
+	void accelerate(float, float, float, float vx, float vy, float vz, float &ax, float &ay, float &az) const
+	{
+		ax -= coefficient * vx; ay -= coefficient * vy; az -= coefficient * vz;
+	}
+};
+
+/* a field given by any callable f(x, y, z, vx, vy, vz, ax, ay, az), for the fields of the user */
+template<typename F>
+struct UserField
+{
+	F f;
+
+	explicit UserField(F f) : f(f) {}
+
+	void accelerate(float x, float y, float z, float vx, float vy, float vz, float &ax, float &ay, float &az) const
+	{
+		f(x, y, z, vx, vy, vz, ax, ay, az);
+	}
+};
+
+template<typename F>
+UserField<F> makeUserField(F f) {return UserField<F>(f);}
+
+/* the sum of its fields, unrolled by the compiler, the empty pipeline adds nothing */
+template<typename... Fields>
+class ForcePipeline
+{
+public:
+	static const bool empty = sizeof...(Fields) == 0;
+
+	explicit ForcePipeline(const Fields&... fields) : fields(fields...) {}
+
+	void accelerate(float x, float y, float z, float vx, float vy, float vz, float &ax, float &ay, float &az) const
+	{
+		accelerate(x, y, z, vx, vy, vz, ax, ay, az, std::index_sequence_for<Fields...>());
+	}
+
+private:
+	std::tuple<Fields...> fields;
+
+	template<size_t... I>
+	void accelerate([[maybe_unused]] float x, [[maybe_unused]] float y, [[maybe_unused]] float z,
+	                [[maybe_unused]] float vx, [[maybe_unused]] float vy, [[maybe_unused]] float vz,
+	                [[maybe_unused]] float &ax, [[maybe_unused]] float &ay, [[maybe_unused]] float &az, std::index_sequence<I...>) const // unused by the empty pipeline
+	{
+		(std::get<I>(fields).accelerate(x, y, z, vx, vy, vz, ax, ay, az), ...);
+	}
+};
+
+template<typename... Fields>
+ForcePipeline<Fields...> makeForcePipeline(const Fields&... fields) {return ForcePipeline<Fields...>(fields...);}
+#endif
@@ -0,0 +1,84 @@
+#ifndef GRID_LAYOUT_H
+#define GRID_LAYOUT_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#define LAYOUT_TILE_SIZE 8 // side of the square tiles of ParticleLayout::Tiled, 8x8 particles fill 4 cache lines per coordinate
+
+/* Order of the particles of a Flag in memory */
+enum class ParticleLayout
+{
+	RowMajor, // the particle (x,y) is at index y*width + x
+	Morton, // Z-order curve: the particles close in the grid are close in memory in both directions
+	Tiled // square tiles of LAYOUT_TILE_SIZE particles stored one after the other, row major inside a tile
+};
+
+/* Maps the cells (x,y) of a grid to the indices of the particles in the store, and back.
+Morton and tiled orders are made dense by ranking the cells by their key, so any grid size works.
+*/
+class GridLayout
+{
+public:
+	GridLayout(int width = 0, int height = 0, ParticleLayout type = ParticleLayout::RowMajor) : width(width), height(height), layout_type(type)
+	{
+		if (type == ParticleLayout::RowMajor)
+			return;
+
+		const int count = width * height;
+		std::vector<uint64_t> key(count);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				key[y * width + x] = type == ParticleLayout::Morton ? mortonKey(x, y) : tileKey(x, y);
+			}
+		}
+		particle_cell.resize(count);
+		std::iota(particle_cell.begin(), particle_cell.end(), 0u);
+		std::sort(particle_cell.begin(), particle_cell.end(), [&](uint32_t a, uint32_t b) {return key[a] < key[b];});
+		cell_particle.resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			cell_particle[particle_cell[i]] = i;
+		}
+	}
+
+	ParticleLayout type() const {return layout_type;}
+
+	/* index in the store of the particle (x,y) */
+	int index(int x, int y) const {return cell_particle.empty() ? y * width + x : cell_particle[y * width + x];}
+
+	/* grid coordinates of the particle i */
+	int x(int i) const {return (cell_particle.empty() ? i : particle_cell[i]) % width;}
+	int y(int i) const {return (cell_particle.empty() ? i : particle_cell[i]) / width;}
+
+private:
+	int width, height;
+	ParticleLayout layout_type;
+	std::vector<uint32_t> cell_particle; // the particle of the cell y*width + x, empty for the row major layout
+	std::vector<uint32_t> particle_cell; // the cell y*width + x of the particle i
+
+	static uint64_t spreadBits(uint32_t v)
+	{
+		uint64_t r = v;
+		r = (r | (r << 16)) & 0x0000FFFF0000FFFFull;
+		r = (r | (r << 8)) & 0x00FF00FF00FF00FFull;
+		r = (r | (r << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		r = (r | (r << 2)) & 0x3333333333333333ull;
+		r = (r | (r << 1)) & 0x5555555555555555ull;
+		return r;
+	}
+
+	static uint64_t mortonKey(int x, int y) {return spreadBits(x) | (spreadBits(y) << 1);}
+
+	uint64_t tileKey(int x, int y) const
+	{
+		const int tiles_width = (width + LAYOUT_TILE_SIZE - 1) / LAYOUT_TILE_SIZE;
+		const uint64_t tile = (uint64_t)(y / LAYOUT_TILE_SIZE) * tiles_width + x / LAYOUT_TILE_SIZE;
+		return tile * LAYOUT_TILE_SIZE * LAYOUT_TILE_SIZE + (y % LAYOUT_TILE_SIZE) * LAYOUT_TILE_SIZE + x % LAYOUT_TILE_SIZE;
+	}
+};
+#endif
@@ -0,0 +1,124 @@
+#ifndef JACOBI_SOLVER_H
+#define JACOBI_SOLVER_H
+
+#include <Base/ParticleStore.h>
+#include <Base/ThreadPool.h>
+#include <Base/ConstraintKernel.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+/* Jacobi relaxation of the constraints: every iteration computes the corrections of all the constraints from a read-only snapshot
+of the positions, sums the corrections of each particle, averages them and writes the new positions in a second buffer.
+Each particle gathers the corrections of its own constraints, so the particles can be shared between threads without any data race,
+at the cost of a slower convergence than Gauss-Seidel.
+*/
+class JacobiSolver
+{
+public:
+	/* ConstraintList is any container of constraints exposing p1, p2 and rest_id */
+	template<typename ConstraintList>
+	void build(const ConstraintList &constraints, int num_particles)
+	{
+		// adjacency of the particles in compressed rows: the constraints of particle i are [neighbor_begin[i], neighbor_begin[i+1])
+		neighbor_begin.assign(num_particles + 1, 0);
+		for (const auto &constraint : constraints)
+		{
+			neighbor_begin[constraint.p1 + 1]++;
+			neighbor_begin[constraint.p2 + 1]++;
+		}
+		for (int i = 0; i < num_particles; i++)
+			neighbor_begin[i + 1] += neighbor_begin[i];
+		std::vector<int> next(neighbor_begin.begin(), neighbor_begin.end() - 1);
+		neighbor.resize(neighbor_begin[num_particles]);
+		rest_id.resize(neighbor_begin[num_particles]);
+		for (const auto &constraint : constraints)
+		{
+			int i = next[constraint.p1]++;
+			neighbor[i] = constraint.p2;
+			rest_id[i] = constraint.rest_id;
+			i = next[constraint.p2]++;
+			neighbor[i] = constraint.p1;
+			rest_id[i] = constraint.rest_id;
+		}
+
+		next_x.assign(num_particles, 0.0f);
+		next_y.assign(num_particles, 0.0f);
+		next_z.assign(num_particles, 0.0f);
+	}
+
+	bool isBuilt() const {return !neighbor_begin.empty();}
+
+	/* runs iterations Jacobi iterations with the thread t of num_threads, every thread must call it,
+	the barrier separates two iterations. Call finish() once every thread is done. */
+	void solve(ParticleStore &particles, const RestLengthTable &rest_lengths, int iterations, int t, int num_threads, SpinBarrier *barrier)
+	{
+		const int count = particles.size();
+		const int begin = (int)((long long)count * t / num_threads);
+		const int end = (int)((long long)count * (t + 1) / num_threads);
+		float *buffers[2][3] = {{particles.pos_x.data(), particles.pos_y.data(), particles.pos_z.data()},
+		                        {next_x.data(), next_y.data(), next_z.data()}};
+		for (int i = 0; i < iterations; i++)
+		{
+			float **read = buffers[i & 1];
+			float **write = buffers[(i + 1) & 1];
+			relax(particles, rest_lengths, read, write, begin, end);
+			if (barrier)
+				barrier->wait();
+		}
+		if (t == 0)
+			swapped = (iterations & 1) != 0;
+	}
+
+	/* after an odd number of iterations the positions are in the second buffer, they are swapped back into the store */
+	void finish(ParticleStore &particles)
+	{
+		if (swapped)
+		{
+			particles.pos_x.swap(next_x);
+			particles.pos_y.swap(next_y);
+			particles.pos_z.swap(next_z);
+			swapped = false;
+		}
+	}
+
+private:
+	std::vector<int> neighbor_begin;
+	std::vector<uint32_t> neighbor; // the other particle of each constraint of a particle
+	std::vector<uint8_t> rest_id; // the id of the rest length of each constraint of a particle
+	std::vector<float> next_x, next_y, next_z; // the positions written by the current iteration
+	bool swapped = false;
+
+	void relax(const ParticleStore &particles, const RestLengthTable &rest_lengths, float *const *read, float *const *write, int begin, int end)
+	{
+		const float *x = read[0], *y = read[1], *z = read[2];
+		for (int p = begin; p < end; p++)
+		{
+			float cx = 0.0f, cy = 0.0f, cz = 0.0f;
+			const int first = neighbor_begin[p], last = neighbor_begin[p + 1];
+			if (particles.isMovable(p) && last > first)
+			{
+				for (int k = first; k < last; k++)
+				{
+					const int q = neighbor[k];
+					const float dx = x[q] - x[p], dy = y[q] - y[p], dz = z[q] - z[p];
+					// half of the correction that moves p at rest_distance of q
+					const float s = 0.5f * (1.0f - rest_lengths[rest_id[k]] / sqrtf(dx*dx + dy*dy + dz*dz));
+					cx += dx * s;
+					cy += dy * s;
+					cz += dz * s;
+				}
+				const float average = 1.0f / (last - first);
+				cx *= average;
+				cy *= average;
+				cz *= average;
+			}
+			write[0][p] = x[p] + cx;
+			write[1][p] = y[p] + cy;
+			write[2][p] = z[p] + cz;
+		}
+	}
+};
+#endif
@@ -0,0 +1,166 @@
+#ifndef MULTIGRID_SOLVER_H
+#define MULTIGRID_SOLVER_H
+
+#include <Base/ParticleStore.h>
+#include <Base/GridLayout.h>
+#include <Base/SleepTracker.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#define MULTIGRID_MIN_SIZE 4 // the coarsest grid keeps at least this many particles in each direction
+#define MULTIGRID_ITERATIONS 4 // how many sweeps of constraint satisfaction on each coarse grid
+
+/* Hierarchical constraint satisfaction for large flags: a Gauss-Seidel sweep only moves an error by one constraint,
+so the sag of a 1000x1000 flag needs hundreds of sweeps to cross the grid. The coarse grid of level l keeps one particle
+every 2^l particles of the Flag in each direction, its constraints connect neighbor particles of the coarse grid.
+Each time step goes from the coarsest grid to the finest one: the coarse particles are sampled from the Flag,
+the coarse constraints are satisfied, and the corrections are interpolated back (bilinearly) onto every particle of the Flag.
+The coarse constraints only resist stretching, a coarse spring must not push apart particles the cloth has folded.
+The Flag grid itself is then solved as usual.
+*/
+class MultigridSolver
+{
+public:
+	void build(const ParticleStore &particles, const GridLayout &layout, int width, int height, float cell_width, float cell_height)
+	{
+		levels.clear();
+		for (int scale = 2; (width - 1) / scale + 1 >= MULTIGRID_MIN_SIZE && (height - 1) / scale + 1 >= MULTIGRID_MIN_SIZE; scale *= 2)
+		{
+			Level level;
+			level.scale = scale;
+			level.width = (width - 1) / scale + 1;
+			level.height = (height - 1) / scale + 1;
+			const int count = level.width * level.height;
+			level.x.resize(count); level.y.resize(count); level.z.resize(count);
+			level.start_x.resize(count); level.start_y.resize(count); level.start_z.resize(count);
+			level.particle.resize(count);
+			level.movable.resize(count);
+			level.weight.resize(count);
+			for (int Y = 0; Y < level.height; Y++)
+			{
+				for (int X = 0; X < level.width; X++)
+				{
+					const int p = layout.index(X * scale, Y * scale);
+					level.particle[Y * level.width + X] = p;
+					level.movable[Y * level.width + X] = particles.isMovable(p) ? 1.0f : 0.0f;
+				}
+			}
+			const int offsets[4][2] = {{1,0}, {0,1}, {1,1}, {-1,1}};
+			for (int k = 0; k < 4; k++)
+			{
+				level.rest_distance[k] = Vec3(offsets[k][0] * scale * cell_width, offsets[k][1] * scale * cell_height, 0).length();
+			}
+			levels.push_back(level);
+		}
+		grid_width = width;
+		grid_height = height;
+	}
+
+	bool isBuilt() const {return grid_width > 0;}
+	int numLevels() const {return (int)levels.size() + 1;} // the Flag grid included
+
+	/* the corrections of every coarse grid, from the coarsest to the finest, the Flag grid is left to the caller.
+	The particles of the inactive tiles of sleep_tracker are held where they are, on the coarse grids as on the Flag grid */
+	void solveCoarse(ParticleStore &particles, const GridLayout &layout, const SleepTracker *sleep_tracker = nullptr)
+	{
+		for (int l = (int)levels.size() - 1; l >= 0; l--)
+		{
+			Level &level = levels[l];
+			restrict(particles, level, sleep_tracker);
+			for (int i = 0; i < MULTIGRID_ITERATIONS; i++)
+			{
+				satisfyLevel(level);
+			}
+			prolongate(particles, layout, level, sleep_tracker);
+		}
+	}
+
+private:
+	struct Level
+	{
+		int width, height, scale; // the particle (X,Y) of this grid is the particle (X*scale, Y*scale) of the Flag
+		std::vector<float> x, y, z; // the positions of the coarse particles, row major
+		std::vector<float> start_x, start_y, start_z; // the positions sampled from the Flag, before the coarse constraints
+		std::vector<int> particle; // the index in the store of the particle of the Flag under each coarse particle
+		std::vector<float> movable; // 1 when the coarse particle can move, 0 when it is pinned
+		std::vector<float> weight; // movable, and 0 for the particles of the inactive tiles during this time step
+		float rest_distance[4]; // the rest lengths of the offsets (1,0), (0,1), (1,1), (-1,1)
+	};
+	std::vector<Level> levels; // levels[0] is the finest coarse grid
+	int grid_width = 0, grid_height = 0;
+
+	void restrict(const ParticleStore &particles, Level &level, const SleepTracker *sleep_tracker)
+	{
+		for (int i = 0; i < (int)level.particle.size(); i++)
+		{
+			const int p = level.particle[i];
+			level.x[i] = level.start_x[i] = particles.pos_x[p];
+			level.y[i] = level.start_y[i] = particles.pos_y[p];
+			level.z[i] = level.start_z[i] = particles.pos_z[p];
+			level.weight[i] = sleep_tracker && !sleep_tracker->isActive(p) ? 0.0f : level.movable[i];
+		}
+	}
+
+	void satisfyLevel(Level &level)
+	{
+		const int w = level.width;
+		for (int Y = 0; Y < level.height; Y++)
+		{
+			for (int X = 0; X < w; X++)
+			{
+				const int i = Y * w + X;
+				if (X + 1 < w) satisfyStretch(level, i, i + 1, level.rest_distance[0]);
+				if (Y + 1 < level.height)
+				{
+					satisfyStretch(level, i, i + w, level.rest_distance[1]);
+					if (X + 1 < w) satisfyStretch(level, i, i + w + 1, level.rest_distance[2]);
+					if (X > 0) satisfyStretch(level, i, i + w - 1, level.rest_distance[3]);
+				}
+			}
+		}
+	}
+
+	/* same correction as Constraint::satisfyConstraint() but only when the particles are further apart than at rest */
+	void satisfyStretch(Level &level, int p1, int p2, float rest_distance)
+	{
+		const float dx = level.x[p2] - level.x[p1], dy = level.y[p2] - level.y[p1], dz = level.z[p2] - level.z[p1];
+		const float current_distance = sqrtf(dx*dx + dy*dy + dz*dz);
+		if (current_distance <= rest_distance)
+			return;
+		const float s = (1 - rest_distance / current_distance) * 0.5f;
+		const float s1 = s * level.weight[p1], s2 = s * level.weight[p2];
+		level.x[p1] += dx * s1; level.y[p1] += dy * s1; level.z[p1] += dz * s1;
+		level.x[p2] -= dx * s2; level.y[p2] -= dy * s2; level.z[p2] -= dz * s2;
+	}
+
+	/* adds to every particle of the Flag the bilinear interpolation of the corrections of the four coarse particles around it,
+	the particles beyond the last coarse row or column take the correction of the nearest coarse particles */
+	void prolongate(ParticleStore &particles, const GridLayout &layout, const Level &level, const SleepTracker *sleep_tracker)
+	{
+		const float inverse_scale = 1.0f / level.scale;
+		for (int y = 0; y < grid_height; y++)
+		{
+			const int Y0 = std::min(y / level.scale, level.height - 1), Y1 = std::min(Y0 + 1, level.height - 1);
+			const float fy = Y1 > Y0 ? (y - Y0 * level.scale) * inverse_scale : 0.0f;
+			for (int x = 0; x < grid_width; x++)
+			{
+				const int X0 = std::min(x / level.scale, level.width - 1), X1 = std::min(X0 + 1, level.width - 1);
+				const float fx = X1 > X0 ? (x - X0 * level.scale) * inverse_scale : 0.0f;
+				const int i00 = Y0 * level.width + X0, i10 = Y0 * level.width + X1;
+				const int i01 = Y1 * level.width + X0, i11 = Y1 * level.width + X1;
+				const float w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+				Vec3 correction(
+					w00 * (level.x[i00] - level.start_x[i00]) + w10 * (level.x[i10] - level.start_x[i10]) + w01 * (level.x[i01] - level.start_x[i01]) + w11 * (level.x[i11] - level.start_x[i11]),
+					w00 * (level.y[i00] - level.start_y[i00]) + w10 * (level.y[i10] - level.start_y[i10]) + w01 * (level.y[i01] - level.start_y[i01]) + w11 * (level.y[i11] - level.start_y[i11]),
+					w00 * (level.z[i00] - level.start_z[i00]) + w10 * (level.z[i10] - level.start_z[i10]) + w01 * (level.z[i01] - level.start_z[i01]) + w11 * (level.z[i11] - level.start_z[i11]));
+				const int p = layout.index(x, y);
+				if (!sleep_tracker || sleep_tracker->isActive(p))
+					particles.offsetPos(p, correction);
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,298 @@
+#ifndef PARTICLE_STORE_H
+#define PARTICLE_STORE_H
+
+#include <Base/Vec3.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+/* Some physics constants */
+#define DAMPING 0.01 // how much to damp the Flag simulation each frame
+#define TIME_STEPSIZE2 1 // how large time step each particle takes each frame
+#define CONSTRAINT_ITERATIONS 15 // how many iterations of constraint satisfaction each frame (more is rigid, less is soft)
+#define MASS 1 // mass of one particle
+
+/* The particle store holds every particle of a Flag as a structure of arrays:
+one contiguous array per coordinate of the position, the previous position, the acceleration and the accumulated normal.
+Each pass over the particles only streams the arrays it actually reads, instead of whole 56 bytes particles.
+Particles are adressed by their index in the arrays, pinned particles are flagged in a bitmask (one bit per particle).
+*/
+class ParticleStore
+{
+private:
+	int count = 0;
+	float mass = MASS; // the mass of one particle (is always 1 in this example)
+
+public:
+	std::vector<float> pos_x, pos_y, pos_z; // the current position of the particles in 3D space
+	std::vector<float> old_x, old_y, old_z; // the position of the particles in the previous time step, used as part of the verlet numerical integration scheme
+	std::vector<float> acc_x, acc_y, acc_z; // the current acceleration of the particles
+	std::vector<float> normal_x, normal_y, normal_z; // the unit normals of the particles computed by Flag::updateNormals(), used for OpenGL soft shading
+	std::vector<uint32_t> pinned; // bit i is set when particle i can not move, used to pin parts of the Flag
+	std::vector<uint32_t> sleeping; // bit i is set when particle i sleeps: it has no velocity and is not integrated, constraints still move it
+
+	void resize(int num_particles)
+	{
+		count = num_particles;
+		for (std::vector<float> *array : {&pos_x, &pos_y, &pos_z, &old_x, &old_y, &old_z,
+		                                  &acc_x, &acc_y, &acc_z, &normal_x, &normal_y, &normal_z})
+		{
+			array->assign(num_particles, 0.0f);
+		}
+		pinned.assign((num_particles + 31) / 32, 0u);
+		sleeping.assign((num_particles + 31) / 32, 0u);
+	}
+
+	int size() const {return count;}
+
+	/* places particle i at rest at the position pos */
+	void init(int i, Vec3 pos)
+	{
+		pos_x[i] = old_x[i] = pos.f[0];
+		pos_y[i] = old_y[i] = pos.f[1];
+		pos_z[i] = old_z[i] = pos.f[2];
+	}
+
+	Vec3 getPos(int i) const {return Vec3(pos_x[i], pos_y[i], pos_z[i]);}
+
+	Vec3 getOldPos(int i) const {return Vec3(old_x[i], old_y[i], old_z[i]);}
+
+	Vec3 getNormal(int i) const {return Vec3(normal_x[i], normal_y[i], normal_z[i]);} // of unit length once Flag::updateNormals() computed it
+
+	bool isMovable(int i) const {return !((pinned[i >> 5] >> (i & 31)) & 1u);}
+
+	void makeUnmovable(int i) {pinned[i >> 5] |= 1u << (i & 31);}
+
+	void setSleeping(int i, bool asleep)
+	{
+		if (asleep)
+			sleeping[i >> 5] |= 1u << (i & 31);
+		else
+			sleeping[i >> 5] &= ~(1u << (i & 31));
+	}
+
+	float inverseMass(int i) const {return isMovable(i) ? 1.0f/mass : 0.0f;} // 0 for a pinned particle
+
+	void addForce(int i, Vec3 f)
+	{
+		acc_x[i] += f.f[0]/mass;
+		acc_y[i] += f.f[1]/mass;
+		acc_z[i] += f.f[2]/mass;
+	}
+
+	/* adds the same force to every particle, only the acceleration arrays are streamed */
+	void addForceAll(Vec3 f)
+	{
+		accumulate(acc_x.data(), f.f[0]/mass);
+		accumulate(acc_y.data(), f.f[1]/mass);
+		accumulate(acc_z.data(), f.f[2]/mass);
+	}
+
+	void offsetPos(int i, Vec3 v)
+	{
+		if (isMovable(i))
+		{
+			pos_x[i] += v.f[0];
+			pos_y[i] += v.f[1];
+			pos_z[i] += v.f[2];
+		}
+	}
+
+	/* verlet integration of every movable particle,
+	the acceleration is reset since it HAS been translated into a change in position (and implicitely into velocity) */
+	void timeStep()
+	{
+		timeStep((float)DAMPING, (float)TIME_STEPSIZE2, true);
+	}
+
+	/* same integration over a time step of square time2, the forces are kept for the next call unless clear_forces is set */
+	void timeStep(float damping, float time2, bool clear_forces)
+	{
+		integrate(pos_x.data(), old_x.data(), acc_x.data(), damping, time2, clear_forces, 0, count);
+		integrate(pos_y.data(), old_y.data(), acc_y.data(), damping, time2, clear_forces, 0, count);
+		integrate(pos_z.data(), old_z.data(), acc_z.data(), damping, time2, clear_forces, 0, count);
+	}
+
+	/* the same integration fused with the force fields of a ForcePipeline (see ForceFields.h): the acceleration of each particle is the
+	accumulated one plus the fields, summed in registers, so the fields cost no pass over the particles. The empty pipeline is timeStep() */
+	template<typename Fields>
+	void timeStep(const Fields &fields, float damping_rate, float time2, bool clear_forces)
+	{
+		if constexpr (Fields::empty)
+		{
+			timeStep(damping_rate, time2, clear_forces);
+			return;
+		}
+		integrateFields(fields, 1.0f - damping_rate, time2, clear_forces ? 0.0f : 1.0f, 0, count);
+	}
+
+	template<typename Fields>
+	void timeStep(const Fields &fields)
+	{
+		timeStep(fields, (float)DAMPING, (float)TIME_STEPSIZE2, true);
+	}
+
+	/* timeStep() for the particles first <= i < last only, the ranges of several threads can share a word of the bitmasks */
+	void timeStep(int first, int last)
+	{
+		integrate(pos_x.data(), old_x.data(), acc_x.data(), (float)DAMPING, (float)TIME_STEPSIZE2, true, first, last);
+		integrate(pos_y.data(), old_y.data(), acc_y.data(), (float)DAMPING, (float)TIME_STEPSIZE2, true, first, last);
+		integrate(pos_z.data(), old_z.data(), acc_z.data(), (float)DAMPING, (float)TIME_STEPSIZE2, true, first, last);
+	}
+
+	/* timeStep(fields) for the particles first <= i < last only, as timeStep(first, last) */
+	template<typename Fields>
+	void timeStep(const Fields &fields, int first, int last)
+	{
+		if constexpr (Fields::empty)
+			timeStep(first, last);
+		else
+			integrateFields(fields, 1.0f - (float)DAMPING, (float)TIME_STEPSIZE2, 0.0f, first, last);
+	}
+
+	/* moves the particle i to the index destination[i], every array is permuted */
+	void permute(const std::vector<uint32_t> &destination)
+	{
+		std::vector<float> permuted(count);
+		for (std::vector<float> *array : {&pos_x, &pos_y, &pos_z, &old_x, &old_y, &old_z,
+		                                  &acc_x, &acc_y, &acc_z, &normal_x, &normal_y, &normal_z})
+		{
+			for (int i = 0; i < count; i++)
+				permuted[destination[i]] = (*array)[i];
+			array->swap(permuted);
+		}
+		std::vector<uint32_t> permuted_pinned(pinned.size(), 0u);
+		for (int i = 0; i < count; i++)
+		{
+			if (!isMovable(i))
+				permuted_pinned[destination[i] >> 5] |= 1u << (destination[i] & 31);
+		}
+		pinned.swap(permuted_pinned);
+		std::fill(sleeping.begin(), sleeping.end(), 0u); // the particles are woken up
+	}
+
+	void addToNormal(int i, Vec3 normal)
+	{
+		Vec3 n = normal.normalized();
+		normal_x[i] += n.f[0];
+		normal_y[i] += n.f[1];
+		normal_z[i] += n.f[2];
+	}
+
+	void resetNormals()
+	{
+		std::fill(normal_x.begin(), normal_x.end(), 0.0f);
+		std::fill(normal_y.begin(), normal_y.end(), 0.0f);
+		std::fill(normal_z.begin(), normal_z.end(), 0.0f);
+	}
+
+private:
+	void accumulate(float *acc, float a)
+	{
+		const int n = count;
+		for (int i = 0; i < n; i++) acc[i] += a;
+	}
+
+	/* the fused integration of the particles first <= i < last, the pinned and sleeping ones only drop their forces */
+	template<typename Fields>
+	void integrateFields(const Fields &fields, float damping, float time2, float cleared, int first, int last)
+	{
+		for (int base = first; base < last;)
+		{
+			const int word_end = std::min(((base >> 5) + 1) << 5, last);
+			if ((pinned[base >> 5] | sleeping[base >> 5]) == 0)
+			{
+				// the words without pinned or sleeping particle that follow each other make one run of the vectorized loop
+				int end = word_end;
+				while (end < last && (pinned[end >> 5] | sleeping[end >> 5]) == 0)
+					end += 32;
+				integrateRange(fields, base, std::min(end, last), damping, time2, cleared);
+				base = std::min(end, last);
+				continue;
+			}
+			const uint32_t word = pinned[base >> 5] | sleeping[base >> 5];
+			for (int i = base; i < word_end; i++)
+			{
+				if (!((word >> (i & 31)) & 1u))
+					integrateRange(fields, i, i + 1, damping, time2, cleared);
+				else
+				{
+					acc_x[i] *= cleared;
+					acc_y[i] *= cleared;
+					acc_z[i] *= cleared;
+				}
+			}
+			base = word_end;
+		}
+	}
+
+	/* the fused integration of the particles begin <= i < end */
+	template<typename Fields>
+	void integrateRange(const Fields &fields, int begin, int end, float damping, float dt2, float cleared)
+	{
+		integrateRange(fields, pos_x.data(), pos_y.data(), pos_z.data(), old_x.data(), old_y.data(), old_z.data(),
+		               acc_x.data(), acc_y.data(), acc_z.data(), begin, end, damping, dt2, cleared);
+	}
+
+	/* the arrays are distinct, the compiler vectorizes the loop once it knows it (restrict on the parameters, a restrict local is not enough for gcc) */
+	template<typename Fields>
+	static void integrateRange(const Fields &fields, float *__restrict px, float *__restrict py, float *__restrict pz,
+	                           float *__restrict ox, float *__restrict oy, float *__restrict oz,
+	                           float *__restrict ax, float *__restrict ay, float *__restrict az,
+	                           int begin, int end, float damping, float dt2, float cleared)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const float x = px[i], y = py[i], z = pz[i];
+			const float vx = x - ox[i], vy = y - oy[i], vz = z - oz[i];
+			float a_x = ax[i], a_y = ay[i], a_z = az[i];
+			fields.accelerate(x, y, z, vx, vy, vz, a_x, a_y, a_z);
+			px[i] = x + vx * damping + a_x * dt2;
+			py[i] = y + vy * damping + a_y * dt2;
+			pz[i] = z + vz * damping + a_z * dt2;
+			ox[i] = x;
+			oy[i] = y;
+			oz[i] = z;
+			ax[i] *= cleared;
+			ay[i] *= cleared;
+			az[i] *= cleared;
+		}
+	}
+
+	/* integrates one coordinate, pinned and sleeping particles keep their position (one 32 bits word of the bitmasks covers 32 particles).
+	Words without any pinned or sleeping particle, which are most of them, take a branchless loop the compiler vectorizes */
+	void integrate(float *pos, float *old, float *acc, float damping_rate, float dt2, bool clear_forces, int first, int last)
+	{
+		const float damping = 1.0f - damping_rate;
+		const float cleared = clear_forces ? 0.0f : 1.0f;
+		for (int base = first & ~31; base < last; base += 32)
+		{
+			const int begin = std::max(base, first);
+			const int end = std::min(base + 32, last);
+			const uint32_t word = pinned[base >> 5] | sleeping[base >> 5];
+			if (word == 0)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					const float temp = pos[i];
+					pos[i] = pos[i] + (pos[i] - old[i]) * damping + acc[i] * dt2;
+					old[i] = temp;
+					acc[i] *= cleared;
+				}
+				continue;
+			}
+			for (int i = begin; i < end; i++)
+			{
+				if (!((word >> (i - base)) & 1u))
+				{
+					const float temp = pos[i];
+					pos[i] = pos[i] + (pos[i] - old[i]) * damping + acc[i] * dt2;
+					old[i] = temp;
+				}
+				acc[i] *= cleared;
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,110 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include <Base/FixedStepClock.h>
+#include <Base/FlagSnapshot.h>
+#include <Base/TripleBuffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+/* Steps a Flag on its own thread at SIMULATION_RATE time steps per second and publishes a FlagSnapshot after each batch of steps
+through a TripleBuffer, so the render thread draws the last snapshot while the next time step is computed: a frame costs
+the rendering only instead of the simulation plus the rendering. Each time step runs step(flag), which applies the forces and calls timeStep().
+Simulation is the Flag class, it needs writeSnapshot(). Nothing else may touch the Flag while the thread runs,
+except Flag::render(snapshot) which only reads its grid.
+*/
+template<typename Simulation>
+class SimulationThread
+{
+public:
+	typedef std::function<void(Simulation&)> Step;
+
+	SimulationThread(Simulation &simulation, Step step_function, float step = 1.0f / SIMULATION_RATE)
+		: simulation(simulation), step_function(step_function), step(step), epoch(std::chrono::steady_clock::now()) {}
+
+	~SimulationThread() {stop();}
+
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	/* publishes the current state of the Flag then starts stepping it */
+	void start()
+	{
+		if (running)
+			return;
+		publish(0);
+		snapshots.update();
+		running = true;
+		thread = std::thread(&SimulationThread::loop, this);
+	}
+
+	void stop()
+	{
+		running = false;
+		if (thread.joinable())
+			thread.join();
+	}
+
+	bool isRunning() const {return running;}
+
+	/* render thread: the last snapshot published, it stays valid until the next call */
+	const FlagSnapshot &latest()
+	{
+		snapshots.update();
+		return snapshots.readBuffer();
+	}
+
+	/* render thread: how far the display is from the previous state (0) to the state (1) of the last snapshot, for Flag::render(snapshot, alpha) */
+	float alpha() const
+	{
+		const float elapsed = (float)(now() - snapshots.readBuffer().time);
+		return std::min(std::max(elapsed / step, 0.0f), 1.0f);
+	}
+
+private:
+	Simulation &simulation;
+	Step step_function; // one time step of the simulation, its forces included
+	float step; // the length of a time step in seconds
+	std::chrono::steady_clock::time_point epoch;
+	TripleBuffer<FlagSnapshot> snapshots;
+	std::atomic<bool> running{false};
+	std::thread thread;
+
+	double now() const {return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();}
+
+	void publish(long long steps)
+	{
+		FlagSnapshot &snapshot = snapshots.writeBuffer();
+		simulation.writeSnapshot(snapshot);
+		snapshot.time = now();
+		snapshot.steps = steps;
+		snapshots.publish();
+	}
+
+	void loop()
+	{
+		FixedStepClock clock(step);
+		long long steps = 0;
+		double last = now();
+		while (running)
+		{
+			const double current = now();
+			const int num_steps = clock.advance((float)(current - last));
+			last = current;
+			for (int s = 0; s < num_steps; s++)
+			{
+				step_function(simulation);
+				steps++;
+			}
+			if (num_steps > 0)
+				publish(steps);
+			else // nothing to do until the next time step is due
+				std::this_thread::sleep_for(std::chrono::duration<float>((1.0f - clock.alpha()) * step));
+		}
+	}
+};
+#endif
@@ -0,0 +1,176 @@
+#ifndef SLEEP_TRACKER_H
+#define SLEEP_TRACKER_H
+
+#include <Base/ParticleStore.h>
+#include <Base/GridLayout.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#define SLEEP_TILE_SIZE 16 // side of the square tiles of particles that fall asleep together
+#define SLEEP_THRESHOLD 1e-2f // a tile is still when none of its particles moved more than this fraction of a cell during the time step
+#define SLEEP_FRAMES 30 // how many still time steps in a row before a tile falls asleep
+
+/* Puts to sleep the tiles of a Flag that stopped moving. The particles of a sleeping tile have no velocity, the integration skips them
+(ParticleStore::setSleeping), and the tile is inactive when its eight neighbors sleep too: the solver, the wind and the normals skip the
+inactive tiles, since neither their particles nor the particles around them move, and the constraints of the active tiles hold the particles
+of the inactive ones where they are (satisfyConstraintHeld). The active tiles which sleep are still watched,
+a constraint or a neighbor moving them wakes them up. A moving tile wakes its neighbors, and a change of the forces wakes every tile.
+*/
+class SleepTracker
+{
+public:
+	void build(const GridLayout &layout, int width, int height, float cell_size)
+	{
+		tiles_width = (width + SLEEP_TILE_SIZE - 1) / SLEEP_TILE_SIZE;
+		tiles_height = (height + SLEEP_TILE_SIZE - 1) / SLEEP_TILE_SIZE;
+		const int num_tiles = tiles_width * tiles_height;
+		const int count = width * height;
+		threshold2 = SLEEP_THRESHOLD * cell_size * SLEEP_THRESHOLD * cell_size;
+
+		// the particles of each tile in compressed rows, in memory order
+		particle_tile.resize(count);
+		tile_begin.assign(num_tiles + 1, 0);
+		for (int i = 0; i < count; i++)
+		{
+			particle_tile[i] = (layout.y(i) / SLEEP_TILE_SIZE) * tiles_width + layout.x(i) / SLEEP_TILE_SIZE;
+			tile_begin[particle_tile[i] + 1]++;
+		}
+		for (int t = 0; t < num_tiles; t++)
+			tile_begin[t + 1] += tile_begin[t];
+		std::vector<int> next(tile_begin.begin(), tile_begin.end() - 1);
+		tile_particle.resize(count);
+		for (int i = 0; i < count; i++)
+			tile_particle[next[particle_tile[i]]++] = i;
+
+		asleep.assign(num_tiles, 0);
+		active.assign(num_tiles, 1);
+		still_frames.assign(num_tiles, 0);
+		num_sleeping = 0;
+	}
+
+	bool isBuilt() const {return !tile_begin.empty();}
+	int numTiles() const {return (int)asleep.size();}
+	int numSleeping() const {return num_sleeping;}
+
+	/* false when the particle, its tile and the tiles around it sleep: nothing around the particle moves */
+	bool isActive(int i) const {return active[particle_tile[i]] != 0;}
+
+	/* the tile (tx,ty) of the grid, for the passes sweeping the grid tile by tile */
+	bool isTileActive(int tx, int ty) const {return active[ty * tiles_width + tx] != 0;}
+
+	void wakeAll(ParticleStore &particles)
+	{
+		for (int t = 0; t < numTiles(); t++)
+			wake(particles, t);
+		updateActive();
+	}
+
+	/* called after each time step: measures how far the particles of the active tiles moved, puts the still tiles to sleep
+	and wakes the sleeping tiles which moved, with their neighbors */
+	void update(ParticleStore &particles)
+	{
+		bool changed = false;
+		std::vector<int> moving;
+		for (int t = 0; t < numTiles(); t++)
+		{
+			if (!active[t])
+				continue;
+			if (isMoving(particles, t))
+			{
+				still_frames[t] = 0;
+				moving.push_back(t);
+			}
+			else if (!asleep[t] && ++still_frames[t] >= SLEEP_FRAMES)
+			{
+				sleep(particles, t);
+				changed = true;
+			}
+		}
+		for (int t : moving)
+		{
+			const int tx = t % tiles_width, ty = t / tiles_width;
+			for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tiles_height - 1); y++)
+			{
+				for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tiles_width - 1); x++)
+				{
+					if (asleep[y * tiles_width + x])
+					{
+						wake(particles, y * tiles_width + x);
+						changed = true;
+					}
+				}
+			}
+		}
+		if (changed)
+			updateActive();
+	}
+
+private:
+	int tiles_width = 0, tiles_height = 0;
+	float threshold2 = 0.0f; // the square of the distance under which a particle is still
+	std::vector<int> particle_tile; // the tile of each particle
+	std::vector<int> tile_begin; // the particles of tile t are tile_particle[tile_begin[t]] to tile_particle[tile_begin[t+1]-1]
+	std::vector<int> tile_particle;
+	std::vector<uint8_t> asleep; // 1 when the tile sleeps
+	std::vector<uint8_t> active; // 0 when the tile and its eight neighbors sleep
+	std::vector<int> still_frames; // the number of time steps in a row the tile did not move
+	int num_sleeping = 0;
+
+	/* the velocity of a sleeping particle is 0, any difference between its position and its previous position is a move */
+	bool isMoving(const ParticleStore &particles, int t) const
+	{
+		for (int k = tile_begin[t]; k < tile_begin[t + 1]; k++)
+		{
+			const int i = tile_particle[k];
+			const float dx = particles.pos_x[i] - particles.old_x[i];
+			const float dy = particles.pos_y[i] - particles.old_y[i];
+			const float dz = particles.pos_z[i] - particles.old_z[i];
+			if (dx*dx + dy*dy + dz*dz > threshold2)
+				return true;
+		}
+		return false;
+	}
+
+	void sleep(ParticleStore &particles, int t)
+	{
+		for (int k = tile_begin[t]; k < tile_begin[t + 1]; k++)
+		{
+			const int i = tile_particle[k];
+			particles.old_x[i] = particles.pos_x[i];
+			particles.old_y[i] = particles.pos_y[i];
+			particles.old_z[i] = particles.pos_z[i];
+			particles.setSleeping(i, true);
+		}
+		asleep[t] = 1;
+		num_sleeping++;
+	}
+
+	void wake(ParticleStore &particles, int t)
+	{
+		if (!asleep[t])
+			return;
+		for (int k = tile_begin[t]; k < tile_begin[t + 1]; k++)
+			particles.setSleeping(tile_particle[k], false);
+		asleep[t] = 0;
+		still_frames[t] = 0;
+		num_sleeping--;
+	}
+
+	void updateActive()
+	{
+		for (int ty = 0; ty < tiles_height; ty++)
+		{
+			for (int tx = 0; tx < tiles_width; tx++)
+			{
+				uint8_t any_awake = 0;
+				for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tiles_height - 1); y++)
+					for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tiles_width - 1); x++)
+						any_awake |= !asleep[y * tiles_width + x];
+				active[ty * tiles_width + tx] = any_awake;
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,168 @@
+#ifndef STENCIL_SOLVER_H
+#define STENCIL_SOLVER_H
+
+#include <Base/ParticleStore.h>
+#include <Base/ConstraintKernel.h>
+#include <Base/GridLayout.h>
+#include <Base/SleepTracker.h>
+
+#include <algorithm>
+
+#define STENCIL_REACH 2 // the largest vertical offset of the stencil, a row only moves the particles of the STENCIL_REACH rows below it
+#define TEMPORAL_TILE_BYTES (256*1024) // the positions a tile of satisfyBlocked() keeps in flight, about the size of a private L2
+
+/* Constraint satisfaction for a regular grid without any list of constraints:
+the constraints of a Flag always follow the same stencil, each particle (x,y) is connected to (x+1,y), (x,y+1), (x+1,y+1), (x-1,y+1)
+and to the same offsets at distance 2. The neighbor pairs are generated from the grid coordinates while sweeping the grid row after row,
+so the solver reads the positions as a stream and stores nothing but the particles.
+The indices of the particles come from the layout of the Flag.
+*/
+class StencilSolver
+{
+public:
+	StencilSolver(const GridLayout &layout, int width, int height, float cell_width, float cell_height, const SleepTracker *sleep_tracker = nullptr)
+		: layout(layout), width(width), height(height), cell_width(cell_width), cell_height(cell_height), sleep_tracker(sleep_tracker) {}
+
+	/* satisfies every constraint of the stencil once, row after row, returns the sum of the squared relative violations met by the sweep */
+	float satisfy(ParticleStore &particles) const
+	{
+		float violation = 0.0f;
+		for (int y = 0; y < height; y++)
+		{
+			if (!sleep_tracker || (isRowActive(y) && isRowActive(std::min(y + STENCIL_REACH, height - 1))))
+			{
+				violation += satisfyRows(particles, y, 0, width);
+				continue;
+			}
+			// the tiles of the row one after the other, the inactive ones are skipped: all the particles they reach sleep.
+			// The constraints of the active tiles which reach an inactive tile hold its particles where they are
+			for (int x = 0; x < width; x += SLEEP_TILE_SIZE)
+			{
+				if (sleep_tracker->isTileActive(x / SLEEP_TILE_SIZE, y / SLEEP_TILE_SIZE))
+					violation += satisfyRows<true>(particles, y, x, std::min(x + SLEEP_TILE_SIZE, width));
+			}
+		}
+		return violation;
+	}
+
+	/* satisfy() for the rows y_first <= y < y_last only, which also move the STENCIL_REACH rows below them */
+	float satisfyBand(ParticleStore &particles, int y_first, int y_last) const
+	{
+		float violation = 0.0f;
+		for (int y = y_first; y < std::min(y_last, height); y++)
+			violation += satisfyRows(particles, y, 0, width);
+		return violation;
+	}
+
+	/* iterations sweeps of satisfy() with temporal blocking: the grid is cut in strips of columns sized so that
+	the rows in flight stay in cache, and each strip runs every iteration before the next one is loaded.
+	Inside a strip the iterations follow a wavefront, the iteration i sweeps the row s - i*lag at the step s:
+	a row only moves the rows below it up to STENCIL_REACH, so the iteration i+1 reads rows the iteration i has finished
+	and the result is the same as the reference ordering inside a strip. The constraints crossing the edges of a strip change the order:
+	the offsets (1,0), (1,1), (2,0) and (2,2) of its last columns move the first columns of the next strip (its halo) before that strip is solved,
+	and the offsets (-1,1) and (-2,2) of its first columns move the last two columns of the previous strip after that strip ran all its iterations.
+	There is no change of order when the grid fits in one strip. */
+	void satisfyBlocked(ParticleStore &particles, int iterations) const
+	{
+		const int lag = STENCIL_REACH + 1;
+		const int tile_width = std::max(8, TEMPORAL_TILE_BYTES / (int)(lag * iterations * 3 * sizeof(float)));
+		for (int x_first = 0; x_first < width; x_first += tile_width)
+		{
+			const int x_last = std::min(width, x_first + tile_width);
+			for (int step = 0; step < height + (iterations - 1) * lag; step++)
+			{
+				for (int i = 0; i < iterations; i++)
+				{
+					const int y = step - i * lag;
+					if (y >= 0 && y < height)
+						satisfyRows(particles, y, x_first, x_last);
+				}
+			}
+		}
+	}
+
+	/* the number of constraints of the stencil */
+	int numConstraints() const
+	{
+		const int offsets[8][2] = {{1,0}, {0,1}, {1,1}, {-1,1}, {2,0}, {0,2}, {2,2}, {-2,2}};
+		int count = 0;
+		for (int k = 0; k < 8; k++)
+		{
+			count += std::max(0, width - abs(offsets[k][0])) * std::max(0, height - offsets[k][1]);
+		}
+		return count;
+	}
+
+private:
+	const GridLayout &layout;
+	int width, height;
+	float cell_width, cell_height;
+	const SleepTracker *sleep_tracker; // the sleeping tiles to skip, or nullptr
+
+	bool isRowActive(int y) const
+	{
+		for (int x = 0; x < width; x += SLEEP_TILE_SIZE)
+		{
+			if (!sleep_tracker->isTileActive(x / SLEEP_TILE_SIZE, y / SLEEP_TILE_SIZE))
+				return false;
+		}
+		return true;
+	}
+
+	/* every offset of the stencil for the particles (x,y) with x_first <= x < x_last, which are active.
+	Held: the neighbors (x+DX,y+DY) in an inactive tile are held where they are */
+	template<bool Held = false>
+	float satisfyRows(ParticleStore &particles, int y, int x_first, int x_last) const
+	{
+		float violation = satisfyRow<1, 0, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<0, 1, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<1, 1, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<-1, 1, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<2, 0, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<0, 2, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<2, 2, Held>(particles, y, x_first, x_last);
+		violation += satisfyRow<-2, 2, Held>(particles, y, x_first, x_last);
+		return violation;
+	}
+
+	/* the constraints between (x,y) and (x+DX,y+DY) for every x of the row y, the offset is known at compile time
+	so the bounds and the index arithmetic fold, only the rest length depends on the spacing of the grid */
+	template<int DX, int DY, bool Held>
+	float satisfyRow(ParticleStore &particles, int y, int x_first, int x_last) const
+	{
+		if (y + DY >= height)
+			return 0.0f;
+		const float rest_distance = Vec3(DX * cell_width, DY * cell_height, 0).length();
+		const int x_begin = std::max(x_first, -DX);
+		const int x_end = std::min(x_last, width - std::max(0, DX));
+		float violation = 0.0f;
+		if (Held)
+		{
+			for (int x = x_begin; x < x_end; x++)
+			{
+				const int p1 = layout.index(x, y), p2 = layout.index(x + DX, y + DY);
+				const float v = sleep_tracker->isActive(p2) ? satisfyConstraintScalar(particles, p1, p2, rest_distance)
+				                                            : satisfyConstraintHeld(particles, p1, p2, rest_distance);
+				violation += v * v;
+			}
+			return violation;
+		}
+		if (layout.type() == ParticleLayout::RowMajor)
+		{
+			const int row = y * width;
+			for (int x = x_begin; x < x_end; x++)
+			{
+				const float v = satisfyConstraintScalar(particles, row + x, row + DY * width + x + DX, rest_distance);
+				violation += v * v;
+			}
+			return violation;
+		}
+		for (int x = x_begin; x < x_end; x++)
+		{
+			const float v = satisfyConstraintScalar(particles, layout.index(x, y), layout.index(x + DX, y + DY), rest_distance);
+			violation += v * v;
+		}
+		return violation;
+	}
+};
+#endif
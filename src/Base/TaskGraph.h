@@ -0,0 +1,128 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <Base/ThreadPool.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/* A static graph of tasks run by the threads of a ThreadPool: a task starts as soon as the tasks it depends on are done,
+so independent work of different phases overlaps instead of waiting at a barrier after each phase.
+The graph is built once, running it allocates nothing: the counters and the queue of ready tasks are sized when the graph changes,
+and each task is a plain function called with a context pointer and an integer argument.
+*/
+class TaskGraph
+{
+public:
+	typedef void (*Function)(void *context, int argument);
+
+	TaskGraph() : worker([this](int) {work();}) {}
+
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	int size() const {return (int)tasks.size();}
+	bool empty() const {return tasks.empty();}
+
+	void clear()
+	{
+		tasks.clear();
+		successors.clear();
+		num_dependencies.clear();
+	}
+
+	/* returns the id of the new task */
+	int add(Function function, void *context, int argument)
+	{
+		tasks.push_back({function, context, argument});
+		successors.emplace_back();
+		num_dependencies.push_back(0);
+		return size() - 1;
+	}
+
+	/* task only starts once prerequisite is done, a negative prerequisite is ignored */
+	void depend(int task, int prerequisite)
+	{
+		if (prerequisite < 0)
+			return;
+		successors[prerequisite].push_back(task);
+		num_dependencies[task]++;
+	}
+
+	/* runs every task once on the threads of pool, returns when they are all done */
+	void run(ThreadPool &pool)
+	{
+		const int count = size();
+		if (allocated != count)
+		{
+			remaining.reset(new std::atomic<int>[count]);
+			ready.reset(new std::atomic<int>[count]);
+			allocated = count;
+		}
+		for (int t = 0; t < count; t++)
+		{
+			remaining[t].store(num_dependencies[t], std::memory_order_relaxed);
+			ready[t].store(-1, std::memory_order_relaxed);
+		}
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		done.store(0, std::memory_order_relaxed);
+		for (int t = 0; t < count; t++)
+		{
+			if (num_dependencies[t] == 0)
+				push(t);
+		}
+		pool.run(worker);
+	}
+
+private:
+	struct Task
+	{
+		Function function;
+		void *context;
+		int argument;
+	};
+	std::vector<Task> tasks;
+	std::vector<std::vector<int>> successors; // the tasks depending on each task
+	std::vector<int> num_dependencies;
+	std::unique_ptr<std::atomic<int>[]> remaining; // the prerequisites of each task not done yet in the current run
+	std::unique_ptr<std::atomic<int>[]> ready; // the queue of ready tasks, every task enters it once per run, -1 in the slots not written yet
+	int allocated = 0;
+	std::atomic<int> head{0}, tail{0}; // the next slot of the queue to take and to fill
+	std::atomic<int> done{0};
+	const std::function<void(int)> worker; // what every thread of the pool runs, kept so that run() does not build it again
+
+	void push(int task)
+	{
+		ready[tail.fetch_add(1, std::memory_order_acq_rel)].store(task, std::memory_order_release);
+	}
+
+	void work()
+	{
+		const int count = size();
+		for (int spin = 0; done.load(std::memory_order_acquire) < count; spin++)
+		{
+			int slot = head.load(std::memory_order_acquire);
+			if (slot >= tail.load(std::memory_order_acquire) || !head.compare_exchange_weak(slot, slot + 1, std::memory_order_acq_rel))
+			{
+				if (spin > 1000)
+					std::this_thread::yield();
+				continue;
+			}
+			int task;
+			while ((task = ready[slot].load(std::memory_order_acquire)) < 0) {} // the slot is reserved, its task is being written
+			tasks[task].function(tasks[task].context, tasks[task].argument);
+			for (int successor : successors[task])
+			{
+				if (remaining[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+					push(successor);
+			}
+			done.fetch_add(1, std::memory_order_acq_rel);
+			spin = 0;
+		}
+	}
+};
+#endif
@@ -0,0 +1,124 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed set of worker threads running the same task together (fork-join).
+run() executes task(thread_index) on every thread of the pool, the calling thread being thread 0, and returns once all of them are done.
+The workers sleep between two calls of run().
+*/
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int num_threads)
+	{
+		for (int i = 1; i < num_threads; i++)
+		{
+			workers.emplace_back(&ThreadPool::workerLoop, this, i);
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		start_cv.notify_all();
+		for (std::thread &worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const {return (int)workers.size() + 1;}
+
+	void run(const std::function<void(int)> &task)
+	{
+		if (workers.empty())
+		{
+			task(0);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			current_task = &task;
+			pending = (int)workers.size();
+			generation++;
+		}
+		start_cv.notify_all();
+		task(0);
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [this]() {return pending == 0;});
+		current_task = nullptr;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable start_cv, done_cv;
+	const std::function<void(int)> *current_task = nullptr;
+	int generation = 0; // incremented by every call of run()
+	int pending = 0; // workers that have not finished the current task
+	bool stopping = false;
+
+	void workerLoop(int index)
+	{
+		int seen_generation = 0;
+		while (true)
+		{
+			const std::function<void(int)> *task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				start_cv.wait(lock, [&]() {return stopping || generation != seen_generation;});
+				if (stopping)
+					return;
+				seen_generation = generation;
+				task = current_task;
+			}
+			(*task)(index);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending--;
+			}
+			done_cv.notify_one();
+		}
+	}
+};
+
+/* A reusable barrier for the threads of a ThreadPool::run() call, the threads spin for a short while then yield their core */
+class SpinBarrier
+{
+public:
+	explicit SpinBarrier(int num_threads) : num_threads(num_threads) {}
+
+	void wait()
+	{
+		const int current = generation.load(std::memory_order_acquire);
+		if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == num_threads)
+		{
+			arrived.store(0, std::memory_order_relaxed);
+			generation.store(current + 1, std::memory_order_release);
+			return;
+		}
+		for (int spin = 0; generation.load(std::memory_order_acquire) == current; spin++)
+		{
+			if (spin > 1000)
+				std::this_thread::yield();
+		}
+	}
+
+private:
+	const int num_threads;
+	std::atomic<int> arrived{0};
+	std::atomic<int> generation{0};
+};
+#endif
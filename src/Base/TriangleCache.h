@@ -0,0 +1,174 @@
+#ifndef TRIANGLE_CACHE_H
+#define TRIANGLE_CACHE_H
+
+#include <Base/ParticleStore.h>
+#include <Base/GridLayout.h>
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+/* The normals of the two triangles of every quad of a Flag, computed once from the positions in one pass over the grid
+and shared by the wind of the next time step and the normals of the particles drawn by render(): both see the same positions,
+those left by the last time step. The quad (x,y) is the entry y*(width-1) + x, its triangle 0 is ((x+1,y), (x,y), (x,y+1))
+and its triangle 1 is ((x+1,y+1), (x+1,y), (x,y+1)), as in Flag::calcTriangleNormal(). Each triangle keeps its cross product,
+whose length is twice its area, and the unit normal. The cache is invalidated whenever the particles move.
+*/
+class TriangleCache
+{
+public:
+	std::vector<float> cross[2][3]; // cross[t][c][q]: the coordinate c of the cross product of the triangle t of the quad q
+	std::vector<float> unit[2][3]; // the same cross products normalized
+
+	bool isValid() const {return valid;}
+	void invalidate() {valid = false;}
+	void validate() {valid = true;} // once buildRows() covered every row of quads
+
+	/* sizes the arrays for a grid of width x height particles */
+	void resize(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+		for (int t = 0; t < 2; t++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				cross[t][c].resize((size_t)(width - 1) * (height - 1));
+				unit[t][c].resize((size_t)(width - 1) * (height - 1));
+			}
+		}
+	}
+
+	void build(const ParticleStore &particles, const GridLayout &layout, int width, int height)
+	{
+		resize(width, height);
+		buildRows(particles, layout, 0, height - 1);
+		valid = true;
+	}
+
+	/* the triangles of the rows of quads y_first <= y < y_last, they read the rows of particles y_first to y_last included.
+	Disjoint rows can be built by several threads */
+	void buildRows(const ParticleStore &particles, const GridLayout &layout, int y_first, int y_last)
+	{
+		const int quads_width = width - 1;
+		const float *px = particles.pos_x.data(), *py = particles.pos_y.data(), *pz = particles.pos_z.data();
+		for (int y = y_first; y < std::min(y_last, height - 1); y++)
+		{
+			const int q0 = y * quads_width;
+			if (layout.type() == ParticleLayout::RowMajor)
+			{
+				// the corners of the quads of the row are contiguous, the rows y and y+1 vectorize
+				const int row = y * width;
+				for (int t = 0; t < 2; t++)
+				{
+					// triangle 0 is ((x+1,y), (x,y), (x,y+1)), triangle 1 is ((x+1,y+1), (x+1,y), (x,y+1))
+					const int p1 = t == 0 ? row + 1 : row + width + 1, p2 = t == 0 ? row : row + 1, p3 = row + width;
+					trianglesRange(px + p1, py + p1, pz + p1, px + p2, py + p2, pz + p2, px + p3, py + p3, pz + p3,
+					               cross[t][0].data() + q0, cross[t][1].data() + q0, cross[t][2].data() + q0,
+					               unit[t][0].data() + q0, unit[t][1].data() + q0, unit[t][2].data() + q0, quads_width);
+				}
+				continue;
+			}
+			for (int x = 0; x < quads_width; x++)
+			{
+				const int a = layout.index(x, y), b = layout.index(x + 1, y), c = layout.index(x, y + 1), d = layout.index(x + 1, y + 1);
+				trianglesRange(px + b, py + b, pz + b, px + a, py + a, pz + a, px + c, py + c, pz + c,
+				               cross[0][0].data() + q0 + x, cross[0][1].data() + q0 + x, cross[0][2].data() + q0 + x,
+				               unit[0][0].data() + q0 + x, unit[0][1].data() + q0 + x, unit[0][2].data() + q0 + x, 1);
+				trianglesRange(px + d, py + d, pz + d, px + b, py + b, pz + b, px + c, py + c, pz + c,
+				               cross[1][0].data() + q0 + x, cross[1][1].data() + q0 + x, cross[1][2].data() + q0 + x,
+				               unit[1][0].data() + q0 + x, unit[1][1].data() + q0 + x, unit[1][2].data() + q0 + x, 1);
+			}
+		}
+	}
+
+	/* The unit normals of the particles of the rows y_first <= y < y_last: each particle reads the triangles it shades and normalizes their sum once.
+	The particle (x,y) takes both triangles of the quad (x-1,y-1), the triangle 1 of (x,y-1), the triangle 0 of (x-1,y) and both triangles of (x,y),
+	added in the order of the quads: the sum is the one of the triangles scattered to their corners quad after quad.
+	Every particle is written by its own gather, so disjoint rows can run on several threads and the result does not depend on how the rows are split.
+	The rows of quads y_first-1 to y_last-1 must be built */
+	void gatherNormalsRows(ParticleStore &particles, const GridLayout &layout, int y_first, int y_last) const
+	{
+		const int quads_width = width - 1;
+		for (int y = y_first; y < y_last; y++)
+		{
+			if (layout.type() != ParticleLayout::RowMajor || y == 0 || y == height - 1 || width < 3)
+			{
+				for (int x = 0; x < width; x++)
+					gatherNormal(particles, layout.index(x, y), x, y);
+				continue;
+			}
+			// the first and last particles of the row have fewer triangles, the others vectorize
+			gatherNormal(particles, y * width, 0, y);
+			const int above = (y - 1) * quads_width, below = y * quads_width, i = y * width + 1;
+			for (int c = 0; c < 3; c++)
+			{
+				float *normal = c == 0 ? particles.normal_x.data() : (c == 1 ? particles.normal_y.data() : particles.normal_z.data());
+				sumRange(unit[0][c].data() + above, unit[1][c].data() + above, unit[1][c].data() + above + 1,
+				         unit[0][c].data() + below, unit[0][c].data() + below + 1, unit[1][c].data() + below + 1, normal + i, width - 2);
+			}
+			normalizeRange(particles.normal_x.data() + i, particles.normal_y.data() + i, particles.normal_z.data() + i, width - 2);
+			gatherNormal(particles, y * width + width - 1, width - 1, y);
+		}
+	}
+
+private:
+	bool valid = false;
+	int width = 0, height = 0;
+
+	/* (p2 - p1) x (p3 - p1) of count consecutive triangles, the restrict parameters let the loop vectorize */
+	static void trianglesRange(const float *__restrict x1, const float *__restrict y1, const float *__restrict z1,
+	                           const float *__restrict x2, const float *__restrict y2, const float *__restrict z2,
+	                           const float *__restrict x3, const float *__restrict y3, const float *__restrict z3,
+	                           float *__restrict cross_x, float *__restrict cross_y, float *__restrict cross_z,
+	                           float *__restrict unit_x, float *__restrict unit_y, float *__restrict unit_z, int count)
+	{
+		for (int k = 0; k < count; k++)
+		{
+			const float v1x = x2[k] - x1[k], v1y = y2[k] - y1[k], v1z = z2[k] - z1[k];
+			const float v2x = x3[k] - x1[k], v2y = y3[k] - y1[k], v2z = z3[k] - z1[k];
+			const float nx = v1y * v2z - v1z * v2y, ny = v1z * v2x - v1x * v2z, nz = v1x * v2y - v1y * v2x;
+			const float length = sqrtf(nx * nx + ny * ny + nz * nz);
+			cross_x[k] = nx; cross_y[k] = ny; cross_z[k] = nz;
+			unit_x[k] = nx / length; unit_y[k] = ny / length; unit_z[k] = nz / length;
+		}
+	}
+
+	/* one coordinate of the six triangles of count consecutive particles inside a row, in the order of gatherNormalsRows() */
+	static void sumRange(const float *__restrict a0, const float *__restrict a1, const float *__restrict b1,
+	                     const float *__restrict c0, const float *__restrict d0, const float *__restrict d1, float *__restrict normal, int count)
+	{
+		for (int k = 0; k < count; k++)
+			normal[k] = a0[k] + a1[k] + b1[k] + c0[k] + d0[k] + d1[k];
+	}
+
+	static void normalizeRange(float *__restrict nx, float *__restrict ny, float *__restrict nz, int count)
+	{
+		for (int k = 0; k < count; k++)
+		{
+			const float length = sqrtf(nx[k] * nx[k] + ny[k] * ny[k] + nz[k] * nz[k]);
+			nx[k] /= length; ny[k] /= length; nz[k] /= length;
+		}
+	}
+
+	/* gatherNormalsRows() of the particle i at (x,y), on the border of the grid or in another layout */
+	void gatherNormal(ParticleStore &particles, int i, int x, int y) const
+	{
+		const int above = (y - 1) * (width - 1) + x, below = y * (width - 1) + x;
+		const bool left = x > 0, right = x < width - 1, up = y > 0, down = y < height - 1;
+		float sum[3];
+		for (int c = 0; c < 3; c++)
+		{
+			sum[c] = 0.0f;
+			if (up && left) {sum[c] += unit[0][c][above - 1]; sum[c] += unit[1][c][above - 1];}
+			if (up && right) sum[c] += unit[1][c][above];
+			if (down && left) sum[c] += unit[0][c][below - 1];
+			if (down && right) {sum[c] += unit[0][c][below]; sum[c] += unit[1][c][below];}
+		}
+		const float length = sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+		particles.normal_x[i] = sum[0] / length;
+		particles.normal_y[i] = sum[1] / length;
+		particles.normal_z[i] = sum[2] / length;
+	}
+};
+#endif
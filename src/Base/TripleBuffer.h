@@ -0,0 +1,44 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include <atomic>
+
+/* Lock-free handoff of a value from one writer thread to one reader thread. Of the three buffers, the writer owns one,
+the reader owns one, and the third one (the middle) is exchanged atomically: publish() swaps the buffer just written with the middle,
+update() swaps the buffer read with the middle when the middle holds a newer value. Neither side ever waits for the other,
+the writer overwrites the values the reader skipped and the reader keeps the last value until a newer one is published.
+*/
+template<typename T>
+class TripleBuffer
+{
+public:
+	/* writer side: the buffer to fill before publish(), it may hold any older value */
+	T &writeBuffer() {return buffers[write_index];}
+
+	void publish()
+	{
+		write_index = middle.exchange(write_index | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	/* reader side: takes the last published value if there is a new one, returns false otherwise */
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		read_index = middle.exchange(read_index, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	const T &readBuffer() const {return buffers[read_index];}
+
+private:
+	static const uint8_t INDEX = 3; // the bits of the index of the middle buffer
+	static const uint8_t FRESH = 4; // set when the middle buffer holds a value the reader has not taken yet
+
+	T buffers[3];
+	std::atomic<uint8_t> middle{1};
+	uint8_t write_index = 0; // only used by the writer
+	uint8_t read_index = 2; // only used by the reader
+};
+#endif
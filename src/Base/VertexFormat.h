@@ -0,0 +1,184 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#if defined(__F16C__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+/* How a vertex (a position and a normal) is stored in the vertex buffer, decoded by the attribute formats and shader.vs.glsl:
+- Float: 3 floats and 3 floats, 24 bytes
+- Half: 3 half floats and a padding half, then the normal as GL_INT_2_10_10_10_REV, 12 bytes
+- Quantized: 3 16-bit values between the bounds of the positions of the frame (the uniforms positionOffset and positionScale),
+  a padding value, then the normal as GL_INT_2_10_10_10_REV, 12 bytes
+- Position: 3 floats and no normal, 12 bytes, the vertex shader derives the normals from the positions of the grid (see Flag::setShaderNormals())
+The attributes stay aligned on 4 bytes, so both compact formats take 12 bytes rather than 10. */
+enum class VertexFormat {Float, Half, Quantized, Position};
+
+inline int vertexSize(VertexFormat format)
+{
+	if (format == VertexFormat::Float)
+		return 6 * sizeof(float);
+	return format == VertexFormat::Position ? 3 * sizeof(float) : 4 * sizeof(uint16_t) + sizeof(uint32_t);
+}
+
+/* rounds to the nearest half float, ties to even, with the conversion instruction of F16C when the target has it */
+inline uint16_t floatToHalf(float value)
+{
+#ifdef __F16C__
+	return (uint16_t)_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	const int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+	if (exponent >= 31)
+		return sign | (((bits >> 23) & 0xFF) == 0xFF && mantissa ? 0x7E00 : 0x7C00); // NaN, or infinity for the overflows
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return sign; // below the smallest subnormal
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		const uint32_t remainder = mantissa & ((1u << shift) - 1), middle = 1u << (shift - 1);
+		if (remainder > middle || (remainder == middle && (half & 1)))
+			half++;
+		return sign | (uint16_t)half;
+	}
+	uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+	const uint32_t remainder = mantissa & 0x1FFF;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++; // a carry into the exponent is still the right rounding
+	return sign | (uint16_t)half;
+#endif
+}
+
+/* a unit normal as three signed normalized 10-bit values, for GL_INT_2_10_10_10_REV */
+inline uint32_t packNormal(float x, float y, float z)
+{
+#ifdef __SSE4_1__
+	// the three components at once, rounded to nearest even as lrintf(), a NaN packs to 0 as well
+	const __m128 clamped = _mm_min_ps(_mm_set1_ps(1.0f), _mm_max_ps(_mm_set1_ps(-1.0f), _mm_set_ps(0.0f, z, y, x)));
+	__m128i packed = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(clamped, _mm_set1_ps(511.0f))), _mm_set1_epi32(0x3FF));
+	packed = _mm_mullo_epi32(packed, _mm_set_epi32(0, 1 << 20, 1 << 10, 1));
+	packed = _mm_or_si128(packed, _mm_shuffle_epi32(packed, _MM_SHUFFLE(1, 0, 3, 2)));
+	packed = _mm_or_si128(packed, _mm_shuffle_epi32(packed, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32_t)_mm_cvtsi128_si32(packed);
+#else
+	auto component = [](float v) {return (uint32_t)(int)lrintf(std::min(std::max(v, -1.0f), 1.0f) * 511.0f) & 0x3FF;};
+	return component(x) | (component(y) << 10) | (component(z) << 20);
+#endif
+}
+
+/* writes vertices in a VertexFormat, the Quantized format between the bounds given to fit() */
+class VertexPacker
+{
+public:
+	VertexFormat format;
+	float offset[3] = {0, 0, 0}, scale[3] = {1, 1, 1}; // position = offset + scale * stored value, the uniforms of the shader
+
+	explicit VertexPacker(VertexFormat format = VertexFormat::Float) : format(format) {}
+
+	/* the bounds of the Quantized format, from the minimum and maximum of the positions that will be stored */
+	void fit(const float minimum[3], const float maximum[3])
+	{
+		if (format != VertexFormat::Quantized)
+			return;
+		for (int c = 0; c < 3; c++)
+		{
+			offset[c] = minimum[c];
+			scale[c] = std::max(maximum[c] - minimum[c], 1e-6f);
+			inverse_scale[c] = 65535.0f / scale[c];
+		}
+	}
+
+	void store(float px, float py, float pz, float nx, float ny, float nz, unsigned char *&vertex) const
+	{
+		if (format == VertexFormat::Float)
+		{
+			const float v[6] = {px, py, pz, nx, ny, nz};
+			memcpy(vertex, v, sizeof(v));
+			vertex += sizeof(v);
+			return;
+		}
+		if (format == VertexFormat::Position)
+		{
+			const float v[3] = {px, py, pz};
+			memcpy(vertex, v, sizeof(v));
+			vertex += sizeof(v);
+			return;
+		}
+		uint16_t position[4];
+		if (format == VertexFormat::Half)
+		{
+#ifdef __F16C__
+			// the three coordinates and the padding in one conversion
+			_mm_storel_epi64((__m128i*)position, _mm_cvtps_ph(_mm_set_ps(0.0f, pz, py, px), _MM_FROUND_TO_NEAREST_INT));
+#else
+			position[0] = floatToHalf(px); position[1] = floatToHalf(py); position[2] = floatToHalf(pz);
+			position[3] = 0;
+#endif
+		}
+		else
+		{
+#ifdef __SSE4_1__
+			// quantize() of the three coordinates at once, the padding lane quantizes 0 to 0
+			const __m128 scaled = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(0.0f, pz, py, px), _mm_set_ps(0.0f, offset[2], offset[1], offset[0])),
+			                                 _mm_set_ps(0.0f, inverse_scale[2], inverse_scale[1], inverse_scale[0]));
+			const __m128i rounded = _mm_cvtps_epi32(_mm_min_ps(_mm_set1_ps(65535.0f), _mm_max_ps(_mm_setzero_ps(), scaled)));
+			_mm_storel_epi64((__m128i*)position, _mm_packus_epi32(rounded, rounded));
+#else
+			position[0] = quantize(px, 0); position[1] = quantize(py, 1); position[2] = quantize(pz, 2);
+			position[3] = 0;
+#endif
+		}
+		const uint32_t normal = packNormal(nx, ny, nz);
+		memcpy(vertex, position, sizeof(position));
+		memcpy(vertex + sizeof(position), &normal, sizeof(normal));
+		vertex += sizeof(position) + sizeof(normal);
+	}
+
+	/* the attributes 0 (position) and 1 (normal) of the vertex buffer bound to GL_ARRAY_BUFFER, the Position format has no normal attribute */
+	static void setupAttributes(VertexFormat format)
+	{
+		const GLsizei stride = vertexSize(format);
+		if (format == VertexFormat::Position)
+		{
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+			glEnableVertexAttribArray(0);
+			return;
+		}
+		if (format == VertexFormat::Float)
+		{
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+		}
+		else
+		{
+			if (format == VertexFormat::Half)
+				glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (void*)0);
+			else
+				glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(4 * sizeof(uint16_t)));
+		}
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+	}
+
+private:
+	float inverse_scale[3] = {65535.0f, 65535.0f, 65535.0f};
+
+	uint16_t quantize(float value, int c) const
+	{
+		return (uint16_t)lrintf(std::min(std::max((value - offset[c]) * inverse_scale[c], 0.0f), 65535.0f));
+	}
+};
+#endif
@@ -0,0 +1,180 @@
+#ifndef VERTEX_RING_H
+#define VERTEX_RING_H
+
+#include <glad/glad.h>
+#include <Base/VertexFormat.h>
+
+#include <vector>
+
+#define VERTEX_RING_REGIONS 3 // the frames of vertices in flight: the CPU writes one while the GPU may still read the two others
+#define VERTEX_RING_TEXTURE_UNIT 0 // of the texture buffer of the Position format
+
+/* The OpenGL objects drawing the vertices of a Flag, created once and kept across frames: a VAO, its element buffer,
+and a vertex buffer holding VERTEX_RING_REGIONS regions of vertices used in turn. With OpenGL 4.4 the vertex buffer is
+allocated by glBufferStorage and mapped once, persistent and coherent: map() returns the region of the frame in the mapped memory,
+the vertices are written there directly, and a fence set after the draw of a region guards it until the GPU is done reading it.
+Without OpenGL 4.4 (the 4.1 context of macOS) map() returns a staging array uploaded by glBufferSubData into the region of the frame.
+The regions are drawn with glDrawElementsBaseVertex, the attributes are specified once for the VertexFormat of the vertices.
+In the Position format the vertex buffer is also a GL_RGB32F texture buffer, the uniform gridPositions of the vertex shader,
+which reads the positions of the neighbours of a vertex to derive its normal.
+Every call needs the OpenGL context current, release() deletes the objects while it still is.
+*/
+class VertexRing
+{
+public:
+	VertexRing() = default;
+	VertexRing(const VertexRing&) = delete;
+	VertexRing& operator=(const VertexRing&) = delete;
+
+	/* the memory of the num_vertices vertices of the next frame, in format, valid until draw() */
+	unsigned char *map(int num_vertices, VertexFormat format = VertexFormat::Float)
+	{
+		if (num_vertices != capacity || format != this->format)
+			create(num_vertices, format);
+		region = (region + 1) % VERTEX_RING_REGIONS;
+		if (!persistent)
+			return staging.data();
+		if (fences[region])
+		{
+			// the region was drawn VERTEX_RING_REGIONS frames ago, its draw is usually done
+			while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+			glDeleteSync(fences[region]);
+			fences[region] = 0;
+		}
+		return mapped + (size_t)region * regionBytes();
+	}
+
+	/* draws the triangles of indices from the vertices written since map(), indices_version changes when indices do.
+	The decode of the positions of packer goes to the uniforms positionOffset and positionScale of the current program.
+	In the Position format the vertices are the grid_width x grid_height particles in row major order, the uniform gridSize */
+	void draw(const std::vector<GLuint> &indices, unsigned indices_version, const VertexPacker &packer = VertexPacker(),
+	          int grid_width = 0, int grid_height = 0)
+	{
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		if (program != uniforms_program)
+		{
+			offset_location = glGetUniformLocation(program, "positionOffset");
+			scale_location = glGetUniformLocation(program, "positionScale");
+			grid_size_location = glGetUniformLocation(program, "gridSize");
+			grid_positions_location = glGetUniformLocation(program, "gridPositions");
+			uniforms_program = program;
+		}
+		glUniform3fv(offset_location, 1, packer.offset);
+		glUniform3fv(scale_location, 1, packer.scale);
+		if (format == VertexFormat::Position)
+		{
+			glUniform2i(grid_size_location, grid_width, grid_height);
+			glUniform1i(grid_positions_location, VERTEX_RING_TEXTURE_UNIT);
+			glActiveTexture(GL_TEXTURE0 + VERTEX_RING_TEXTURE_UNIT);
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+		}
+		else
+			glUniform2i(grid_size_location, 0, 0); // the normals of the vertices
+		glBindVertexArray(vao);
+		if (indices_version != uploaded_version)
+		{
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+			uploaded_version = indices_version;
+		}
+		if (!persistent)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)region * regionBytes(), (GLsizeiptr)regionBytes(), staging.data());
+		}
+		glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, (void*)0, region * capacity);
+		glBindVertexArray(0);
+		if (format == VertexFormat::Position)
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		if (persistent)
+			fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void release()
+	{
+		for (GLsync &fence : fences)
+		{
+			if (fence)
+				glDeleteSync(fence);
+			fence = 0;
+		}
+		if (vao)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			if (persistent)
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ebo);
+		}
+		if (texture)
+			glDeleteTextures(1, &texture);
+		vao = vbo = ebo = texture = 0;
+		mapped = nullptr;
+		capacity = 0;
+		uploaded_version = ~0u;
+		uniforms_program = -1;
+	}
+
+	bool isPersistent() const {return persistent;}
+
+private:
+	GLuint vao = 0, vbo = 0, ebo = 0;
+	GLuint texture = 0; // the texture buffer over vbo, in the Position format
+	int capacity = 0; // the vertices of a region
+	int region = 0; // the region of the current frame
+	VertexFormat format = VertexFormat::Float;
+	bool persistent = false;
+	unsigned char *mapped = nullptr; // the whole persistent buffer
+	GLsync fences[VERTEX_RING_REGIONS] = {};
+	std::vector<unsigned char> staging; // the vertices of the frame without a persistent mapping
+	unsigned uploaded_version = ~0u; // the version of the indices in ebo
+	GLint uniforms_program = -1, offset_location = -1, scale_location = -1; // the uniforms of the positions, looked up again when the program changes
+	GLint grid_size_location = -1, grid_positions_location = -1;
+
+	size_t regionBytes() const {return (size_t)capacity * vertexSize(format);}
+
+	void create(int num_vertices, VertexFormat format)
+	{
+		release();
+		capacity = num_vertices;
+		this->format = format;
+		const GLsizeiptr bytes = (GLsizeiptr)(VERTEX_RING_REGIONS * regionBytes());
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ebo);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		persistent = GLAD_GL_VERSION_4_4 != 0;
+		if (persistent)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+			persistent = mapped != nullptr;
+			if (!persistent)
+			{
+				// the storage of the buffer is immutable, the fallback needs a new one
+				glDeleteBuffers(1, &vbo);
+				glGenBuffers(1, &vbo);
+				glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			}
+		}
+		if (!persistent)
+		{
+			glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+			staging.resize(regionBytes());
+		}
+		VertexPacker::setupAttributes(format);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo); // part of the state of the VAO
+		glBindVertexArray(0);
+		if (format == VertexFormat::Position)
+		{
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, vbo);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+	}
+};
+#endif
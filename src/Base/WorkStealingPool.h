@@ -0,0 +1,148 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A pool of threads running independent tasks of uneven sizes. Every thread has its own queue: a task submitted from a thread of the pool
+goes to the queue of that thread, which runs its most recent task first (the data it just touched is still in cache), and a thread
+with an empty queue steals the oldest task of another queue. The thread calling wait() is the thread 0 of the pool and works until
+every task submitted, including the tasks submitted by the tasks themselves, is done.
+*/
+class WorkStealingPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit WorkStealingPool(int num_threads)
+	{
+		num_threads = std::max(num_threads, 1);
+		for (int i = 0; i < num_threads; i++)
+			queues.emplace_back(new Queue());
+		for (int i = 1; i < num_threads; i++)
+			workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+	}
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	int size() const {return (int)queues.size();}
+
+	/* queues a task, on the queue of the calling thread when it belongs to the pool, on the queue of the thread 0 otherwise */
+	void submit(Task task)
+	{
+		Queue &queue = *queues[current_pool == this ? current_index : 0];
+		pending.fetch_add(1, std::memory_order_relaxed); // before the task can run and be counted done
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queued++;
+		}
+		cv.notify_all();
+	}
+
+	/* runs tasks on the calling thread until every task is done */
+	void wait()
+	{
+		current_pool = this;
+		current_index = 0;
+		while (pending.load(std::memory_order_acquire) > 0)
+		{
+			if (runOne(0))
+				continue;
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this]() {return queued > 0 || pending.load(std::memory_order_acquire) == 0;});
+		}
+		current_pool = nullptr;
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+	std::vector<std::unique_ptr<Queue>> queues; // queues[i] belongs to the thread i
+	std::vector<std::thread> workers;
+	std::mutex mutex; // guards queued and stopping, for the threads waiting for work
+	std::condition_variable cv;
+	int queued = 0; // the tasks waiting in the queues
+	std::atomic<int> pending{0}; // the tasks submitted and not done yet
+	bool stopping = false;
+
+	static inline thread_local WorkStealingPool *current_pool = nullptr; // the pool of the calling thread
+	static inline thread_local int current_index = 0; // its index in that pool
+
+	/* runs the newest task of the queue of the thread index, or the oldest task of another queue, returns false when every queue is empty */
+	bool runOne(int index)
+	{
+		Task task;
+		for (int k = 0; k < size() && !task; k++)
+		{
+			Queue &queue = *queues[(index + k) % size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty())
+				continue;
+			if (k == 0)
+			{
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+			}
+			else
+			{
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+		}
+		if (!task)
+			return false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queued--;
+		}
+		task();
+		if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			cv.notify_all(); // wakes the thread waiting in wait()
+		}
+		return true;
+	}
+
+	void workerLoop(int index)
+	{
+		current_pool = this;
+		current_index = index;
+		while (true)
+		{
+			if (runOne(index))
+				continue;
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [this]() {return stopping || queued > 0;});
+			if (stopping)
+				return;
+		}
+	}
+};
+#endif
@@ -0,0 +1,104 @@
+#ifndef XPBD_SOLVER_H
+#define XPBD_SOLVER_H
+
+#include <Base/ParticleStore.h>
+#include <Base/ConstraintKernel.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#define XPBD_SUBSTEPS 4 // how many substeps the scheduler splits a frame into
+#define XPBD_ITERATIONS 2 // how many iterations of constraint satisfaction each substep
+
+/* Splits one frame of the Flag in substeps of equal length. Each substep predicts the positions with the verlet integration
+(the forces of the frame are applied on every substep) then runs the constraint iterations. Many short substeps converge
+faster than many iterations on one long step, the stiffness itself comes from the compliance of the constraints.
+*/
+struct SubstepScheduler
+{
+	int substeps = XPBD_SUBSTEPS;
+	int iterations = XPBD_ITERATIONS; // per substep
+
+	/* the square of the length of one substep, a frame lasts TIME_STEPSIZE2 */
+	float substepTime2() const {return (float)TIME_STEPSIZE2 / (substeps * substeps);}
+
+	/* the damping of one substep, so that the substeps of a frame damp the velocity by DAMPING */
+	float substepDamping() const {return (float)(1.0 - pow(1.0 - DAMPING, 1.0 / substeps));}
+};
+
+/* Extended position based dynamics: each constraint has a compliance (the inverse of its stiffness, 0 is rigid) and a Lagrange multiplier
+accumulated along the iterations of a substep. The correction of a constraint is scaled by its compliance and by the length of the substep,
+so the stiffness of the flag no longer depends on the number of iterations, more iterations only get closer to it.
+*/
+class XpbdSolver
+{
+public:
+	/* ConstraintList is any container of constraints exposing p1, p2 and rest_id, compliance(c) gives the compliance of the constraint c */
+	template<typename ConstraintList, typename Compliance>
+	void build(const ConstraintList &constraints, Compliance compliance)
+	{
+		const int count = (int)constraints.size();
+		p1.resize(count);
+		p2.resize(count);
+		rest_id.resize(count);
+		constraint_compliance.resize(count);
+		lambda.assign(count, 0.0f);
+		for (int c = 0; c < count; c++)
+		{
+			p1[c] = constraints[c].p1;
+			p2[c] = constraints[c].p2;
+			rest_id[c] = constraints[c].rest_id;
+			constraint_compliance[c] = compliance(c);
+		}
+	}
+
+	bool isBuilt() const {return !lambda.empty();}
+
+	/* one frame: scheduler.substeps substeps, each one integrating the particles then solving the constraints,
+	the forces are cleared by the last substep, the force fields (see ForceFields.h) act on every substep */
+	template<typename Fields>
+	void step(ParticleStore &particles, const RestLengthTable &rest_lengths, const SubstepScheduler &scheduler, const Fields &fields)
+	{
+		const float time2 = scheduler.substepTime2();
+		const float damping = scheduler.substepDamping();
+		for (int s = 0; s < scheduler.substeps; s++)
+		{
+			particles.timeStep(fields, damping, time2, s == scheduler.substeps - 1);
+			std::fill(lambda.begin(), lambda.end(), 0.0f);
+			for (int i = 0; i < scheduler.iterations; i++)
+			{
+				for (int c = 0; c < (int)lambda.size(); c++)
+				{
+					satisfy(particles, c, rest_lengths[rest_id[c]], constraint_compliance[c] / time2);
+				}
+			}
+		}
+	}
+
+private:
+	std::vector<uint32_t> p1, p2;
+	std::vector<uint8_t> rest_id;
+	std::vector<float> constraint_compliance;
+	std::vector<float> lambda; // the Lagrange multiplier of each constraint, accumulated during a substep
+
+	/* C = |p2 - p1| - rest_distance, the multiplier grows by (-C - alpha*lambda) / (w1 + w2 + alpha)
+	where alpha is the compliance divided by the square of the substep and w the inverse masses (0 for a pinned particle) */
+	void satisfy(ParticleStore &particles, int c, float rest_distance, float alpha)
+	{
+		const float w1 = particles.inverseMass(p1[c]), w2 = particles.inverseMass(p2[c]);
+		if (w1 + w2 + alpha == 0.0f)
+			return;
+		Vec3 p1_to_p2 = particles.getPos(p2[c]) - particles.getPos(p1[c]);
+		const float current_distance = p1_to_p2.length();
+		if (current_distance == 0.0f)
+			return;
+		const float delta_lambda = (rest_distance - current_distance - alpha * lambda[c]) / (w1 + w2 + alpha);
+		lambda[c] += delta_lambda;
+		Vec3 correction = p1_to_p2 * (delta_lambda / current_distance); // the gradient of C along p1_to_p2
+		particles.offsetPos(p1[c], correction * -w1);
+		particles.offsetPos(p2[c], correction * w2);
+	}
+};
+#endif
@@ -8,6 +8,8 @@
 #include <Base/Shader.h>
 #include <Base/Camera.h>
 #include <Base/Flag.cpp>
+#include <Base/FixedStepClock.h>
+#include <Base/SimulationThread.h>
 
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -22,6 +24,9 @@
 // ---options --
 bool with_gravity = true;
 bool with_wind = true;
+bool with_simulation_thread = true; // step the flag on its own thread while the frames are drawn
+VertexFormat vertex_format = VertexFormat::Float; // Half or Quantized halve the vertices uploaded each frame
+bool with_shader_normals = false; // upload the positions only, the vertex shader derives the normals
 // -------------
 float flag_width = 3.5f;
 float flag_height = 3.0f;
@@ -87,6 +92,22 @@ int main()
     // render loop
     // -----------
     float gravity_corrected = GRAVITY/(num_particle_width*num_particle_height);
+    auto step_flag = [&](Flag &flag)
+    {
+        if (with_wind)
+            flag.addwindForce(wind_vector); // generate some wind each time step
+
+        // gravity, pointing down, is added by the integration of the time step in the same pass (see ForceFields.h)
+        Vec3 gravity(0, with_gravity ? gravity_corrected/MASS : 0, 0);
+        flag.timeStep(makeForcePipeline(GravityField(gravity))); // calculate the particle positions of the next time step
+    };
+    FixedStepClock sim_clock; // SIMULATION_RATE time steps per second, whatever the refresh rate
+    SimulationThread<Flag> simulation(Flag1, step_flag);
+    Flag1.setInterpolation(true);
+    Flag1.setVertexFormat(vertex_format);
+    Flag1.setShaderNormals(with_shader_normals);
+    if (with_simulation_thread)
+        simulation.start();
     while (!glfwWindowShouldClose(window))
     {
         // per-frame time logic
@@ -119,14 +140,20 @@ int main()
         shader.setVec3("lightPos", camera.Position);
         shader.setVec3("lightColor", glm::vec3(1.0f));
 
-        if (with_gravity)
-            Flag1.addForce(Vec3(0,gravity_corrected,0)); // add gravity each frame, pointing down
-
-        if (with_wind)
-            Flag1.addwindForce(wind_vector); // generate some wind each frame
-        
-        Flag1.timeStep(); // calculate the particle positions of the next frame
-        Flag1.render();
+        if (simulation.isRunning())
+        {
+            // the last state published by the simulation thread, which is already computing the next one
+            const FlagSnapshot &snapshot = simulation.latest();
+            Flag1.render(snapshot, simulation.alpha());
+        }
+        else
+        {
+            // the time steps owed since the previous frame, none when the display runs faster than the simulation
+            int num_steps = sim_clock.advance(deltaTime);
+            for (int step = 0; step < num_steps; step++)
+                step_flag(Flag1);
+            Flag1.render(sim_clock.alpha()); // between the last two time steps
+        }
 
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
@@ -137,6 +164,11 @@ int main()
         ImGui::Begin("Demo window");
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
           1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+        if (simulation.isRunning())
+            ImGui::Text("Simulation thread %d Hz, %lld steps", SIMULATION_RATE, simulation.latest().steps);
+        else
+            ImGui::Text("Simulation %d Hz, %d steps this frame, %d dropped",
+              SIMULATION_RATE, sim_clock.lastSteps(), sim_clock.droppedSteps());
 
         std::stringstream ss;
         ss << "--lookat " << camera.Front.x << "," << camera.Front.y << ","<< camera.Front.z << ", --postion " << camera.Position.x << "," << camera.Position.y << "," << camera.Position.z;
@@ -155,6 +187,8 @@ int main()
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+    simulation.stop();
+    Flag1.releaseBuffers(); // while the OpenGL context exists
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -8,10 +8,54 @@ out vec3 FragPos;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+// the decode of the compact vertex formats (see VertexFormat.h): aPos is normalized between the bounds of the flag for the quantized format,
+// the 10:10:10:2 normal arrives already scaled to [-1,1]
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
+// the shader normals (see Flag::setShaderNormals()): the particles of the grid, 0 when the normals come with the vertices,
+// and the positions of the vertex buffer in row major order
+uniform ivec2 gridSize = ivec2(0);
+uniform samplerBuffer gridPositions;
+
+vec3 gridPosition(int first, int x, int y)
+{
+	return positionOffset + positionScale * texelFetch(gridPositions, first + y * gridSize.x + x).xyz;
+}
+
+// the unit normals of the triangles 0 ((x+1,y), (x,y), (x,y+1)) and 1 ((x+1,y+1), (x+1,y), (x,y+1)) of the quad (x,y), as in TriangleCache.h
+vec3 triangle0(int first, int x, int y)
+{
+	vec3 p1 = gridPosition(first, x + 1, y);
+	return normalize(cross(gridPosition(first, x, y) - p1, gridPosition(first, x, y + 1) - p1));
+}
+
+vec3 triangle1(int first, int x, int y)
+{
+	vec3 p1 = gridPosition(first, x + 1, y + 1);
+	return normalize(cross(gridPosition(first, x + 1, y) - p1, gridPosition(first, x, y + 1) - p1));
+}
+
+// the normal of the vertex gathered as TriangleCache::gatherNormalsRows() does on the CPU.
+// gl_VertexID includes the base vertex of the region drawn, its particle is its place in the region
+vec3 gridNormal()
+{
+	int particle = gl_VertexID % (gridSize.x * gridSize.y);
+	int first = gl_VertexID - particle;
+	int x = particle % gridSize.x, y = particle / gridSize.x;
+	bool left = x > 0, right = x < gridSize.x - 1, up = y > 0, down = y < gridSize.y - 1;
+	vec3 sum = vec3(0.0);
+	if (up && left) sum += triangle0(first, x - 1, y - 1) + triangle1(first, x - 1, y - 1);
+	if (up && right) sum += triangle1(first, x, y - 1);
+	if (down && left) sum += triangle0(first, x - 1, y);
+	if (down && right) sum += triangle0(first, x, y) + triangle1(first, x, y);
+	return normalize(sum);
+}
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    FragPos = vec3(model * vec4(aPos, 1.0));
-}
\ No newline at end of file
+	vec3 position = positionOffset + positionScale * aPos;
+	vec3 normal = gridSize.x > 0 ? gridNormal() : aNormal;
+	gl_Position = projection * view * model * vec4(position, 1.0);
+    Normal = mat3(transpose(inverse(model))) * normal;
+    FragPos = vec3(model * vec4(position, 1.0));
+}